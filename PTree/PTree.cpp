@@ -3,461 +3,8685 @@
 
 #include "stdafx.h"
 #include <string>
+#include <chrono>
+#include <unordered_map>
+#include <fstream>
+#include <typeinfo>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <cmath>
+#include <limits>
+#include <type_traits>
 #include <assert.h>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// SIMD paths of cVector3Kernels: SSE2 on every x86 target, AVX when the compiler targets it
+// (/arch:AVX, -mavx). Other targets run the scalar loops.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PTREE_SSE 1
+#include <immintrin.h>
+#endif
+#if defined(PTREE_SSE) && defined(__AVX__)
+#define PTREE_AVX 1
+#endif
+
+#ifdef _MSC_VER
+#define PTREE_ALIGN(n) __declspec(align(n))
+#else
+#define PTREE_ALIGN(n) alignas(n)
+#endif
+
+// Per-thread variables; VS2013 has no thread_local and __declspec(thread) only takes plain
+// data with constant initializers, so there per-thread objects hang off pointers that are
+// never reset (see cThreadCaches). Elsewhere PTREE_THREAD_LOCAL_OBJECTS is defined and they
+// are destroyed with their thread.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define PTREE_THREAD_LOCAL __declspec(thread)
+#else
+#define PTREE_THREAD_LOCAL thread_local
+#define PTREE_THREAD_LOCAL_OBJECTS 1
+#endif
+
 typedef unsigned int uint;
+typedef unsigned long long uint64;
+
+struct Vector3
+{
+	Vector3() : X(0.f), Y(0.f), Z(0.f) {}
+	Vector3(float x, float y, float z) : X(x), Y(y), Z(z) {}
+
+	float X;
+	float Y;
+	float Z;
+};
+
+// Vector3 padded to 16 bytes, so a point is exactly one SSE register and never straddles a
+// cache line. For scratch arrays of hot loops; properties keep the packed Vector3.
+struct PTREE_ALIGN(16) Vector3A
+{
+	Vector3A() : X(0.f), Y(0.f), Z(0.f), W(0.f) {}
+	Vector3A(float x, float y, float z) : X(x), Y(y), Z(z), W(0.f) {}
+	explicit Vector3A(const Vector3& v) : X(v.X), Y(v.Y), Z(v.Z), W(0.f) {}
+
+	Vector3 ToVector3() const { return Vector3(X, Y, Z); }
+
+	float X;
+	float Y;
+	float Z;
+	float W;	// Padding, kept 0.
+};
+
+typedef boost::property_tree::ptree tBoostPTree;
+
+// Unsigned big integer of fixed capacity for exact float <-> decimal conversions.
+class cBigNum
+{
+public:
+	cBigNum() : Size(0) {}
+	explicit cBigNum(uint64 v) : Size(0)
+	{
+		for (; v; v >>= 32)
+			Words[Size++] = (uint)v;
+	}
+	cBigNum(const cBigNum& other) : Size(other.Size) { memcpy(Words, other.Words, Size * sizeof(uint)); }
+	cBigNum& operator=(const cBigNum& other)
+	{
+		Size = other.Size;
+		memcpy(Words, other.Words, Size * sizeof(uint));
+		return *this;
+	}
+
+	void MulSmall(uint m)
+	{
+		uint64 carry = 0;
+		for (uint i = 0; i < Size; ++i)
+		{
+			carry += (uint64)Words[i] * m;
+			Words[i] = (uint)carry;
+			carry >>= 32;
+		}
+		if (carry)
+			Push((uint)carry);
+	}
+
+	void AddSmall(uint a)
+	{
+		uint64 carry = a;
+		for (uint i = 0; carry && i < Size; ++i)
+		{
+			carry += Words[i];
+			Words[i] = (uint)carry;
+			carry >>= 32;
+		}
+		if (carry)
+			Push((uint)carry);
+	}
+
+	void MulPow5(uint n)
+	{
+		for (; n >= 13; n -= 13)
+			MulSmall(1220703125u);
+		uint p = 1;
+		while (n--)
+			p *= 5;
+		MulSmall(p);
+	}
+
+	void MulPow10(uint n)
+	{
+		MulPow5(n);
+		ShiftLeft(n);
+	}
+
+	void ShiftLeft(uint bits)
+	{
+		if (!Size)
+			return;
+		const uint words = bits / 32;
+		const uint shift = bits % 32;
+		const uint top = shift ? Words[Size - 1] >> (32 - shift) : 0;
+		assert(Size + words + 1 <= SWords);
+		for (uint i = Size; i-- > 0;)
+			Words[i + words] = (Words[i] << shift) | ((shift && i) ? Words[i - 1] >> (32 - shift) : 0);
+		for (uint i = 0; i < words; ++i)
+			Words[i] = 0;
+		Size += words;
+		if (top)
+			Words[Size++] = top;
+	}
+
+	void Add(const cBigNum& b)
+	{
+		uint64 carry = 0;
+		for (uint i = 0; i < b.Size || (carry && i < Size); ++i)
+		{
+			if (i == Size)
+				Words[Size++] = 0;
+			carry += (uint64)Words[i] + (i < b.Size ? b.Words[i] : 0);
+			Words[i] = (uint)carry;
+			carry >>= 32;
+		}
+		if (carry)
+			Push((uint)carry);
+	}
+
+	// Requires *this >= b.
+	void Sub(const cBigNum& b)
+	{
+		uint64 borrow = 0;
+		for (uint i = 0; i < Size; ++i)
+		{
+			const uint64 d = (uint64)Words[i] - (i < b.Size ? b.Words[i] : 0) - borrow;
+			Words[i] = (uint)d;
+			borrow = (d >> 32) & 1;
+		}
+		while (Size && !Words[Size - 1])
+			--Size;
+	}
+
+	static int Compare(const cBigNum& a, const cBigNum& b)
+	{
+		if (a.Size != b.Size)
+			return (a.Size < b.Size) ? -1 : 1;
+		for (uint i = a.Size; i-- > 0;)
+			if (a.Words[i] != b.Words[i])
+				return (a.Words[i] < b.Words[i]) ? -1 : 1;
+		return 0;
+	}
+
+	// Compares a + b with c.
+	static int CompareSum(const cBigNum& a, const cBigNum& b, const cBigNum& c)
+	{
+		cBigNum sum(a);
+		sum.Add(b);
+		return Compare(sum, c);
+	}
+
+private:
+	// Enough for parsing cFloatText::SMaxDigits digits into a double.
+	static const uint SWords = 160;
+
+	void Push(uint w)
+	{
+		assert(Size < SWords);
+		Words[Size++] = w;
+	}
+
+	uint Words[SWords];
+	uint Size;
+};
+
+// Bit layout of F_.
+template <class F_> struct cFloatBits;
+template <> struct cFloatBits<float>
+{
+	typedef uint tBits;
+	static const int SMantissaBits = 23;
+	static const int SExponentBias = 127;
+	static const int SMaxExponent10 = 39;	// Above 10^SMaxExponent10 is infinite,
+	static const int SMinExponent10 = -46;	// below 10^SMinExponent10 is zero.
+};
+template <> struct cFloatBits<double>
+{
+	typedef uint64 tBits;
+	static const int SMantissaBits = 52;
+	static const int SExponentBias = 1023;
+	static const int SMaxExponent10 = 310;
+	static const int SMinExponent10 = -324;
+};
+
+// Text of float and double values. Format() writes the shortest digits that read back to the
+// same value, in fixed notation from 1e-6 up to 1e21 and scientific ("1.5e-7", "1e+21")
+// otherwise, plus "inf", "-inf" and "nan". Parse() reads the same syntax as operator>> in
+// the classic locale, correctly rounded, with surrounding whitespace allowed. Neither
+// depends on locales or streams.
+template <class F_>
+class cFloatText
+{
+public:
+	// Buffer size for Format().
+	static const size_t SSize = 32;
+
+	static size_t Format(F_ value, char* out)
+	{
+		typedef cFloatBits<F_> B;
+		const tBits bits = GetBits(value);
+		const tBits fraction = bits & ((tBits(1) << B::SMantissaBits) - 1);
+		const int exponent = (int)(bits >> B::SMantissaBits) & (2 * B::SExponentBias + 1);
+
+		char* p = out;
+		if (exponent == 2 * B::SExponentBias + 1)
+		{
+			if (fraction)
+				return Copy("nan", p) - out;
+			if (value < 0)
+				*p++ = '-';
+			return Copy("inf", p) - out;
+		}
+		if (bits >> (sizeof(F_) * 8 - 1))
+			*p++ = '-';
+		if (value == 0)
+		{
+			*p++ = '0';
+			return p - out;
+		}
+
+		// Integers are their own shortest digits as long as every integer of their magnitude
+		// is representable.
+		const F_ magnitude = (value < 0) ? -value : value;
+		if (magnitude < F_(tBits(1) << (B::SMantissaBits + 1)) && magnitude == F_((uint64)magnitude))
+			return WriteInteger((uint64)magnitude, p) - out;
+
+		char digits[20];
+		int k;
+		const int n = GetShortestDigits(exponent ? fraction | (tBits(1) << B::SMantissaBits) : fraction,
+			(exponent ? exponent : 1) - B::SExponentBias - B::SMantissaBits, fraction == 0 && exponent > 1, digits, k);
+		return WriteDigits(digits, n, k, p) - out;
+	}
+
+	static bool Parse(const char* p, const char* end, F_& value)
+	{
+		while (p != end && IsSpace(*p))
+			++p;
+		bool negative = false;
+		if (p != end && (*p == '+' || *p == '-'))
+			negative = *p++ == '-';
+
+		if (end - p >= 3 && (Matches(p, "inf") || Matches(p, "nan")))
+		{
+			value = Matches(p, "inf") ? std::numeric_limits<F_>::infinity() : std::numeric_limits<F_>::quiet_NaN();
+			p += 3;
+			if (negative)
+				value = -value;
+			return SkipSpace(p, end);
+		}
+
+		// Significant digits: the first 19 go to 'mantissa' for the fast paths, up to
+		// SMaxDigits are kept for the exact path, the rest only count as nonzero or not.
+		const char* first = nullptr;
+		const char* last = nullptr;
+		uint64 mantissa = 0;
+		int digits = 0;
+		int exponent10 = 0;
+		bool anyDigit = false;
+		bool truncated = false;
+		bool fraction = false;
+		for (; p != end; ++p)
+		{
+			if (*p == '.' && !fraction)
+			{
+				fraction = true;
+				continue;
+			}
+			if (*p < '0' || *p > '9')
+				break;
+			anyDigit = true;
+			if (!digits && *p == '0')
+			{
+				if (fraction)
+					--exponent10;
+				continue;
+			}
+			if (digits < SMaxDigits)
+			{
+				if (!first)
+					first = p;
+				last = p + 1;
+				if (digits < 19)
+					mantissa = mantissa * 10 + (*p - '0');
+				++digits;
+				if (fraction)
+					--exponent10;
+			}
+			else
+			{
+				truncated |= *p != '0';
+				if (!fraction)
+					++exponent10;
+			}
+		}
+		if (!anyDigit)
+			return false;
+
+		if (p != end && (*p == 'e' || *p == 'E'))
+		{
+			++p;
+			bool negativeExponent = false;
+			if (p != end && (*p == '+' || *p == '-'))
+				negativeExponent = *p++ == '-';
+			if (p == end || *p < '0' || *p > '9')
+				return false;
+			int e = 0;
+			for (; p != end && *p >= '0' && *p <= '9'; ++p)
+				if (e < 100000)
+					e = e * 10 + (*p - '0');
+			exponent10 += negativeExponent ? -e : e;
+		}
+		if (!SkipSpace(p, end))
+			return false;
+
+		value = Convert(mantissa, digits, exponent10, truncated, first, last);
+		if (negative)
+			value = -value;
+		return true;
+	}
+
+private:
+	typedef typename cFloatBits<F_>::tBits tBits;
+
+	static const int SMaxDigits = 800;
+
+	static tBits GetBits(F_ v) { tBits bits; memcpy(&bits, &v, sizeof(v)); return bits; }
+	static F_ FromBits(tBits bits) { F_ v; memcpy(&v, &bits, sizeof(v)); return v; }
+
+	static bool IsSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+	static bool Matches(const char* p, const char* word) { return (p[0] | 0x20) == word[0] && (p[1] | 0x20) == word[1] && (p[2] | 0x20) == word[2]; }
+
+	static bool SkipSpace(const char* p, const char* end)
+	{
+		while (p != end && IsSpace(*p))
+			++p;
+		return p == end;
+	}
+
+	static char* Copy(const char* s, char* p)
+	{
+		while (*s)
+			*p++ = *s++;
+		return p;
+	}
+
+	static char* WriteInteger(uint64 v, char* p)
+	{
+		char buffer[20];
+		int n = 0;
+		do
+		{
+			buffer[n++] = char('0' + v % 10);
+			v /= 10;
+		}
+		while (v);
+		while (n)
+			*p++ = buffer[--n];
+		return p;
+	}
+
+	// Writes 0.digits * 10^k.
+	static char* WriteDigits(const char* digits, int n, int k, char* p)
+	{
+		if (k > 21 || k <= -6)
+		{
+			*p++ = digits[0];
+			if (n > 1)
+			{
+				*p++ = '.';
+				memcpy(p, digits + 1, n - 1);
+				p += n - 1;
+			}
+			*p++ = 'e';
+			*p++ = (k - 1 < 0) ? '-' : '+';
+			return WriteInteger((uint64)((k - 1 < 0) ? 1 - k : k - 1), p);
+		}
+		if (k <= 0)
+		{
+			*p++ = '0';
+			*p++ = '.';
+			memset(p, '0', -k);
+			p += -k;
+			memcpy(p, digits, n);
+			return p + n;
+		}
+		if (k < n)
+		{
+			memcpy(p, digits, k);
+			p += k;
+			*p++ = '.';
+			memcpy(p, digits + k, n - k);
+			return p + n - k;
+		}
+		memcpy(p, digits, n);
+		p += n;
+		memset(p, '0', k - n);
+		return p + k - n;
+	}
+
+	// Burger & Dybvig's free-format algorithm on exact integers: the fewest digits that still
+	// lie strictly inside (or, for even mantissas, on the bounds of) the interval rounding to
+	// f * 2^e. Returns their count; the value is 0.digits * 10^k.
+	static int GetShortestDigits(tBits f, int e, bool lowerCloser, char* digits, int& k)
+	{
+		// Estimate from the bit length, at most one or two too low.
+		int bitLength = 0;
+		for (tBits m = f; m; m >>= 1)
+			++bitLength;
+		k = (int)ceil((e + bitLength - 1) * 0.30102999566398114 - 1e-10);
+
+		// Everything stays below 100 times the scale s, so most values never need a cBigNum.
+		const int scaleBits = 2 + (e < 0 ? -e : 0) + (k > 0 ? k * 10 / 3 + 1 : 0) + 4;
+		if (scaleBits <= 56)
+			return GenerateDigits<cSmallNum>(f, e, lowerCloser, digits, k);
+		return GenerateDigits<cBigNum>(f, e, lowerCloser, digits, k);
+	}
+
+	// cBigNum interface over a uint64, for GenerateDigits().
+	class cSmallNum
+	{
+	public:
+		explicit cSmallNum(uint64 v) : Value(v) {}
+
+		void MulSmall(uint m) { Value *= m; }
+		void MulPow10(uint n) { while (n--) Value *= 10; }
+		void ShiftLeft(uint bits) { Value <<= bits; }
+		void Sub(const cSmallNum& b) { Value -= b.Value; }
+
+		static int Compare(const cSmallNum& a, const cSmallNum& b) { return (a.Value < b.Value) ? -1 : (a.Value > b.Value); }
+		static int CompareSum(const cSmallNum& a, const cSmallNum& b, const cSmallNum& c) { return Compare(cSmallNum(a.Value + b.Value), c); }
+
+	private:
+		uint64 Value;
+	};
+
+	template <class N_>
+	static int GenerateDigits(tBits f, int e, bool lowerCloser, char* digits, int& k)
+	{
+		const bool even = (f & 1) == 0;
+		N_ r((uint64)f);
+		N_ s(1);
+		N_ up(1);
+		N_ down(1);
+		if (e >= 0)
+		{
+			r.ShiftLeft(e + 1 + lowerCloser);
+			s.ShiftLeft(1 + lowerCloser);
+			up.ShiftLeft(e + lowerCloser);
+			down.ShiftLeft(e);
+		}
+		else
+		{
+			r.ShiftLeft(1 + lowerCloser);
+			s.ShiftLeft(1 + lowerCloser - e);
+			up.ShiftLeft(lowerCloser);
+		}
+
+		if (k >= 0)
+		{
+			s.MulPow10(k);
+		}
+		else
+		{
+			r.MulPow10(-k);
+			up.MulPow10(-k);
+			down.MulPow10(-k);
+		}
+		while (N_::CompareSum(r, up, s) >= (even ? 0 : 1))
+		{
+			s.MulSmall(10);
+			++k;
+		}
+
+		int n = 0;
+		for (;;)
+		{
+			r.MulSmall(10);
+			up.MulSmall(10);
+			down.MulSmall(10);
+			int d = 0;
+			while (N_::Compare(r, s) >= 0)
+			{
+				r.Sub(s);
+				++d;
+			}
+			const bool low = N_::Compare(r, down) < (even ? 1 : 0);
+			const bool high = N_::CompareSum(r, up, s) >= (even ? 0 : 1);
+			if (low && high)
+			{
+				N_ twice(r);
+				twice.ShiftLeft(1);
+				const int c = N_::Compare(twice, s);
+				d += (c > 0 || (c == 0 && (d & 1))) ? 1 : 0;
+			}
+			else if (high)
+			{
+				++d;
+			}
+			digits[n++] = char('0' + d);
+			if (low || high)
+				return n;
+		}
+	}
+
+	// Value of the digits [first, last) times 10^exponent10, 'mantissa' holding the first 19.
+	static F_ Convert(uint64 mantissa, int digits, int exponent10, bool truncated, const char* first, const char* last)
+	{
+		typedef cFloatBits<F_> B;
+		static const double SPowers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		if (!digits)
+			return 0;
+		if (digits + exponent10 > B::SMaxExponent10)
+			return std::numeric_limits<F_>::infinity();
+		if (digits + exponent10 < B::SMinExponent10)
+			return 0;
+
+		// Clinger's fast path: both operands exact, so the double operation rounds correctly.
+		// For float that double is rounded again, which is only off if it hit a midpoint.
+		int e = exponent10;
+		if (digits <= 19 && !truncated)
+		{
+			uint64 m = mantissa;
+			while (e > 22 && m <= (1ull << 53) / 10)
+			{
+				m *= 10;
+				--e;
+			}
+			if (m <= (1ull << 53) && e >= -22 && e <= 22)
+			{
+				const double d = (e < 0) ? (double)m / SPowers[-e] : (double)m * SPowers[e];
+				if (sizeof(F_) == sizeof(double) || !IsFloatMidpoint(d))
+					return (F_)d;
+			}
+		}
+
+		// Otherwise start from an estimate and correct it against the exact decimal value.
+		const int kept = std::min(digits, 19);
+		const int estimateExponent = exponent10 + digits - kept;
+		double estimate = (double)mantissa;
+		if (estimateExponent < -300)
+			estimate = estimate * 1e-300 * pow(10.0, estimateExponent + 300);
+		else
+			estimate *= pow(10.0, estimateExponent);
+
+		cBigNum decimal;
+		for (const char* p = first; p != last; ++p)
+		{
+			if (*p == '.')
+				continue;
+			decimal.MulSmall(10);
+			decimal.AddSmall(*p - '0');
+		}
+		const int decimalExponent = exponent10;
+
+		const tBits maxBits = ((tBits(2 * B::SExponentBias) << B::SMantissaBits) | ((tBits(1) << B::SMantissaBits) - 1));
+		const F_ max = FromBits(maxBits);
+		tBits c = GetBits(estimate >= (double)max ? max : (F_)estimate);
+		for (;;)
+		{
+			tBits m;
+			int exponent;
+			Decompose(c, m, exponent);
+
+			// Above the midpoint to the next value, or on it with an odd c: round up.
+			int cmp = CompareDecimal(decimal, decimalExponent, truncated, (m << 1) + 1, exponent - 1);
+			if (cmp > 0 || (cmp == 0 && (m & 1)))
+			{
+				if (c == maxBits)
+					return std::numeric_limits<F_>::infinity();
+				++c;
+				continue;
+			}
+			if (c == 0)
+				break;
+
+			// Below the midpoint to the previous value, which is closer where the exponent drops.
+			const bool binadeStart = m == (tBits(1) << B::SMantissaBits) && exponent > 1 - B::SExponentBias - B::SMantissaBits;
+			cmp = binadeStart ? CompareDecimal(decimal, decimalExponent, truncated, (m << 2) - 1, exponent - 2)
+				: CompareDecimal(decimal, decimalExponent, truncated, (m << 1) - 1, exponent - 1);
+			if (cmp < 0 || (cmp == 0 && (m & 1)))
+			{
+				--c;
+				continue;
+			}
+			break;
+		}
+		return FromBits(c);
+	}
+
+	static bool IsFloatMidpoint(double d)
+	{
+		uint64 bits;
+		memcpy(&bits, &d, sizeof(d));
+		return (bits & ((1ull << 29) - 1)) == (1ull << 28);
+	}
+
+	// Positive c as m * 2^exponent.
+	static void Decompose(tBits c, tBits& m, int& exponent)
+	{
+		typedef cFloatBits<F_> B;
+		const int biased = (int)(c >> B::SMantissaBits);
+		m = c & ((tBits(1) << B::SMantissaBits) - 1);
+		if (biased)
+			m |= tBits(1) << B::SMantissaBits;
+		exponent = (biased ? biased : 1) - B::SExponentBias - B::SMantissaBits;
+	}
+
+	// Compares decimal * 10^decimalExponent (plus a bit more if truncated) with m * 2^exponent.
+	static int CompareDecimal(const cBigNum& decimal, int decimalExponent, bool truncated, tBits m, int exponent)
+	{
+		cBigNum left(decimal);
+		cBigNum right((uint64)m);
+		if (decimalExponent >= 0)
+			left.MulPow5(decimalExponent);
+		else
+			right.MulPow5(-decimalExponent);
+		const int shift = decimalExponent - exponent;
+		if (shift > 0)
+			left.ShiftLeft(shift);
+		else
+			right.ShiftLeft(-shift);
+		const int cmp = cBigNum::Compare(left, right);
+		return (cmp == 0 && truncated) ? 1 : cmp;
+	}
+};
+
+// ptree translator formatting and parsing F_ with cFloatText.
+template <class F_>
+class cFloatTranslator
+{
+public:
+	typedef std::string internal_type;
+	typedef F_ external_type;
+
+	boost::optional<F_> get_value(const std::string& v) const
+	{
+		F_ e;
+		if (cFloatText<F_>::Parse(v.data(), v.data() + v.size(), e))
+			return e;
+		return boost::optional<F_>();
+	}
+
+	boost::optional<std::string> put_value(const F_& v) const
+	{
+		char buffer[cFloatText<F_>::SSize];
+		return std::string(buffer, cFloatText<F_>::Format(v, buffer));
+	}
+};
+
+// Replaces stream_translator for float and double in every ptree put/get and everything built
+// on translator_between (FormatXMLValue(), cXMLNodeDeserializer).
+namespace boost { namespace property_tree
+{
+	template <> struct translator_between<std::string, float> { typedef cFloatTranslator<float> type; };
+	template <> struct translator_between<std::string, double> { typedef cFloatTranslator<double> type; };
+}}
+
+// Text of integral values: plain decimal, optional sign ('-' only for signed types), no
+// leading zeros on output. Parse() takes the whole range [first, last) except surrounding
+// whitespace and fails on anything else or on overflow, instead of wrapping "-1" for
+// unsigned types as operator>> does.
+template <class I_>
+class cIntegerText
+{
+public:
+	// Buffer size for Format().
+	static const size_t SSize = std::numeric_limits<I_>::digits10 + 3;
+
+	static size_t Format(I_ value, char* out)
+	{
+		static const char SPairs[] =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+			"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+
+		const bool negative = value < 0;
+		tUnsigned m = negative ? tUnsigned(0) - tUnsigned(value) : tUnsigned(value);
+		char buffer[SSize];
+		char* p = buffer + SSize;
+		while (m >= 100)
+		{
+			const size_t pair = (size_t)(m % 100) * 2;
+			m /= 100;
+			*--p = SPairs[pair + 1];
+			*--p = SPairs[pair];
+		}
+		if (m >= 10)
+		{
+			*--p = SPairs[m * 2 + 1];
+			*--p = SPairs[m * 2];
+		}
+		else
+		{
+			*--p = char('0' + m);
+		}
+		if (negative)
+			*--p = '-';
+
+		const size_t length = buffer + SSize - p;
+		memcpy(out, p, length);
+		return length;
+	}
+
+	static bool Parse(const char* first, const char* last, I_& value)
+	{
+		while (first != last && IsSpace(*first))
+			++first;
+		while (first != last && IsSpace(last[-1]))
+			--last;
+
+		bool negative = false;
+		if (first != last && (*first == '+' || *first == '-'))
+		{
+			negative = *first++ == '-';
+			if (negative && !std::numeric_limits<I_>::is_signed)
+				return false;
+		}
+		if (first == last)
+			return false;
+
+		// Magnitude limit: max(), or one more for a negative value.
+		const tUnsigned limit = tUnsigned(std::numeric_limits<I_>::max()) + (negative ? 1 : 0);
+		tUnsigned m = 0;
+		for (; first != last; ++first)
+		{
+			const uint d = uint(*first - '0');
+			if (d > 9 || m > (limit - d) / 10)
+				return false;
+			m = m * 10 + d;
+		}
+		value = negative ? I_(tUnsigned(0) - m) : I_(m);
+		return true;
+	}
+
+private:
+	typedef typename std::make_unsigned<I_>::type tUnsigned;
+
+	static bool IsSpace(char c)
+	{
+		return c == ' ' || (c >= '\t' && c <= '\r');
+	}
+};
+
+// ptree translator formatting and parsing I_ with cIntegerText.
+template <class I_>
+class cIntegerTranslator
+{
+public:
+	typedef std::string internal_type;
+	typedef I_ external_type;
+
+	boost::optional<I_> get_value(const std::string& v) const
+	{
+		I_ e;
+		if (cIntegerText<I_>::Parse(v.data(), v.data() + v.size(), e))
+			return e;
+		return boost::optional<I_>();
+	}
+
+	boost::optional<std::string> put_value(const I_& v) const
+	{
+		char buffer[cIntegerText<I_>::SSize];
+		return std::string(buffer, cIntegerText<I_>::Format(v, buffer));
+	}
+};
+
+// Same for the integral types; char types keep stream_translator, which treats them as
+// characters.
+namespace boost { namespace property_tree
+{
+	template <> struct translator_between<std::string, short> { typedef cIntegerTranslator<short> type; };
+	template <> struct translator_between<std::string, unsigned short> { typedef cIntegerTranslator<unsigned short> type; };
+	template <> struct translator_between<std::string, int> { typedef cIntegerTranslator<int> type; };
+	template <> struct translator_between<std::string, unsigned int> { typedef cIntegerTranslator<unsigned int> type; };
+	template <> struct translator_between<std::string, long> { typedef cIntegerTranslator<long> type; };
+	template <> struct translator_between<std::string, unsigned long> { typedef cIntegerTranslator<unsigned long> type; };
+	template <> struct translator_between<std::string, long long> { typedef cIntegerTranslator<long long> type; };
+	template <> struct translator_between<std::string, unsigned long long> { typedef cIntegerTranslator<unsigned long long> type; };
+}}
+
+#ifndef PTREE_THREAD_LOCAL_OBJECTS
+// Owns objects created once per thread behind a PTREE_THREAD_LOCAL pointer, until exit.
+class cThreadCaches
+{
+public:
+	class iCache
+	{
+	public:
+		virtual ~iCache() {}
+	};
+
+	template <class C_>
+	static C_* Add(C_* cache)
+	{
+		std::lock_guard<std::mutex> lock(SMutex);
+		SCaches.push_back(std::unique_ptr<iCache>(cache));
+		return cache;
+	}
+
+private:
+	static std::mutex SMutex;
+	static std::vector<std::unique_ptr<iCache>> SCaches;
+};
+
+std::mutex cThreadCaches::SMutex;
+std::vector<std::unique_ptr<cThreadCaches::iCache>> cThreadCaches::SCaches;
+#endif
+
+// The stream pair cCachedStreamTranslator keeps per thread, shared by every E_ converted
+// with the same character type, traits and allocator.
+template <class Ch_, class Tr_, class A_>
+class cTranslatorStreams
+#ifndef PTREE_THREAD_LOCAL_OBJECTS
+	: public cThreadCaches::iCache
+#endif
+{
+public:
+	cTranslatorStreams() : Busy(false), Fill(In.fill()) {}
+
+	static cTranslatorStreams& Get()
+	{
+#ifdef PTREE_THREAD_LOCAL_OBJECTS
+		static thread_local std::unique_ptr<cTranslatorStreams> current;
+		if (!current)
+			current.reset(new cTranslatorStreams);
+		return *current;
+#else
+		static PTREE_THREAD_LOCAL cTranslatorStreams* current = nullptr;
+		if (!current)
+			current = cThreadCaches::Add(new cTranslatorStreams);
+		return *current;
+#endif
+	}
+
+	// Back to the state of a newly constructed stream imbued with loc.
+	void Reset(std::basic_ios<Ch_, Tr_>& s, const std::locale& loc) const
+	{
+		s.clear();
+		s.flags(std::ios_base::skipws | std::ios_base::dec);
+		s.precision(6);
+		s.width(0);
+		s.fill(Fill);
+		if (s.getloc() != loc)
+			s.imbue(loc);
+	}
+
+	std::basic_istringstream<Ch_, Tr_, A_> In;
+	std::basic_ostringstream<Ch_, Tr_, A_> Out;
+	bool Busy;
+
+private:
+	const Ch_ Fill;
+};
+
+// Flags the streams of the thread as in use for the scope.
+template <class Ch_, class Tr_, class A_>
+class cTranslatorStreamsBusy
+{
+public:
+	cTranslatorStreamsBusy(cTranslatorStreams<Ch_, Tr_, A_>& streams) : Streams(streams) { Streams.Busy = true; }
+	~cTranslatorStreamsBusy() { Streams.Busy = false; }
+
+private:
+	cTranslatorStreamsBusy& operator=(const cTranslatorStreamsBusy&);
+
+	cTranslatorStreams<Ch_, Tr_, A_>& Streams;
+};
+
+// stream_translator that reuses one istringstream and one ostringstream per thread (see
+// cTranslatorStreams) instead of constructing them on every call. Buffer, state and format
+// flags are reset between calls and the stream is only re-imbued when the locale differs,
+// so customize_stream sees the same fresh stream it would get from stream_translator. A
+// conversion nested inside another one on the same thread (a stream operator that itself
+// goes through a ptree) falls back to stream_translator.
+template <class Ch_, class Tr_, class A_, class E_>
+class cCachedStreamTranslator
+{
+	typedef boost::property_tree::customize_stream<Ch_, Tr_, E_> tCustomized;
+	typedef cTranslatorStreams<Ch_, Tr_, A_> tStreams;
+	typedef cTranslatorStreamsBusy<Ch_, Tr_, A_> tBusy;
+
+public:
+	typedef std::basic_string<Ch_, Tr_, A_> internal_type;
+	typedef E_ external_type;
+
+	explicit cCachedStreamTranslator(std::locale loc = std::locale()) : Locale(loc) {}
+
+	boost::optional<E_> get_value(const internal_type& v)
+	{
+		tStreams& streams = tStreams::Get();
+		if (streams.Busy)
+			return boost::property_tree::stream_translator<Ch_, Tr_, A_, E_>(Locale).get_value(v);
+
+		tBusy busy(streams);
+		std::basic_istringstream<Ch_, Tr_, A_>& iss = streams.In;
+		streams.Reset(iss, Locale);
+		iss.str(v);
+		E_ e;
+		tCustomized::extract(iss, e);
+		if (iss.fail() || iss.bad() || iss.get() != Tr_::eof())
+			return boost::optional<E_>();
+		return e;
+	}
+
+	boost::optional<internal_type> put_value(const E_& v)
+	{
+		tStreams& streams = tStreams::Get();
+		if (streams.Busy)
+			return boost::property_tree::stream_translator<Ch_, Tr_, A_, E_>(Locale).put_value(v);
+
+		tBusy busy(streams);
+		std::basic_ostringstream<Ch_, Tr_, A_>& oss = streams.Out;
+		streams.Reset(oss, Locale);
+		oss.str(internal_type());
+		tCustomized::insert(oss, v);
+		if (oss)
+			return oss.str();
+		return boost::optional<internal_type>();
+	}
+
+private:
+	std::locale Locale;
+};
+
+// Selects cCachedStreamTranslator for a type converted with its stream operators, at global
+// namespace scope: PTREE_CACHED_STREAM_TRANSLATOR(MyType)
+#define PTREE_CACHED_STREAM_TRANSLATOR(T) \
+	namespace boost { namespace property_tree \
+	{ \
+		template <> struct translator_between<std::string, T> { typedef cCachedStreamTranslator<char, std::char_traits<char>, std::allocator<char>, T> type; }; \
+	}}
+
+// The built-in types still going through streams.
+PTREE_CACHED_STREAM_TRANSLATOR(bool)
+PTREE_CACHED_STREAM_TRANSLATOR(char)
+PTREE_CACHED_STREAM_TRANSLATOR(signed char)
+PTREE_CACHED_STREAM_TRANSLATOR(unsigned char)
+PTREE_CACHED_STREAM_TRANSLATOR(long double)
+
+typedef std::vector<int> tIntArray;
+typedef std::vector<uint> tUIntArray;
+typedef std::vector<float> tFloatArray;
+typedef std::vector<Vector3> tVector3Array;
+
+// Packed XML body of the array property types, one element for the whole array instead of
+// one per value. As text the values are separated by spaces, a Vector3 as its three floats
+// ("1.5 0 -2 7 8 9"), each formatted and parsed like a single value. As base64 it holds the
+// raw elements in native byte order, like binary snapshots. Parsing sizes the vector once.
+class cArrayText
+{
+public:
+	template <class T_>
+	static void Format(const std::vector<T_>& v, std::string& out)
+	{
+		typedef cElement<T_> E;
+		const typename E::tScalar* scalars = reinterpret_cast<const typename E::tScalar*>(v.data());
+		const size_t count = v.size() * E::SScalars;
+		char buffer[E::tText::SSize];
+		out.clear();
+		out.reserve(count * 8);
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (i)
+				out += ' ';
+			out.append(buffer, E::tText::Format(scalars[i], buffer));
+		}
+	}
+
+	template <class T_>
+	static bool Parse(const char* first, const char* last, std::vector<T_>& v)
+	{
+		typedef cElement<T_> E;
+		size_t count = 0;
+		for (const char* p = first; (p = SkipSpace(p, last)) != last; p = SkipToken(p, last))
+			++count;
+		if (count % E::SScalars)
+			return false;
+
+		v.resize(count / E::SScalars);
+		typename E::tScalar* scalars = reinterpret_cast<typename E::tScalar*>(v.data());
+		const char* p = first;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const char* token = SkipSpace(p, last);
+			p = SkipToken(token, last);
+			if (!E::tText::Parse(token, p, scalars[i]))
+				return false;
+		}
+		return true;
+	}
+
+	template <class T_>
+	static void FormatBase64(const std::vector<T_>& v, std::string& out)
+	{
+		static const char SDigits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(v.data());
+		const size_t size = v.size() * sizeof(T_);
+		out.resize((size + 2) / 3 * 4);
+		char* o = &out[0];
+		size_t i = 0;
+		for (; i + 3 <= size; i += 3, o += 4)
+		{
+			const uint b = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+			o[0] = SDigits[b >> 18];
+			o[1] = SDigits[(b >> 12) & 63];
+			o[2] = SDigits[(b >> 6) & 63];
+			o[3] = SDigits[b & 63];
+		}
+		if (i < size)
+		{
+			const uint b = (bytes[i] << 16) | ((i + 1 < size) ? bytes[i + 1] << 8 : 0);
+			o[0] = SDigits[b >> 18];
+			o[1] = SDigits[(b >> 12) & 63];
+			o[2] = (i + 1 < size) ? SDigits[(b >> 6) & 63] : '=';
+			o[3] = '=';
+		}
+	}
+
+	// Whitespace between the digits is ignored.
+	template <class T_>
+	static bool ParseBase64(const char* first, const char* last, std::vector<T_>& v)
+	{
+		size_t digits = 0;
+		size_t padding = 0;
+		for (const char* p = first; p != last; ++p)
+		{
+			if (*p == '=')
+				++padding;
+			else if (!IsSpace(*p))
+			{
+				if (padding || GetBase64Digit(*p) < 0)
+					return false;
+				++digits;
+			}
+		}
+		if ((digits + padding) % 4 || padding > 2 || (padding && digits % 4 + padding != 4))
+			return false;
+		const size_t size = digits * 3 / 4;
+		if (size % sizeof(T_))
+			return false;
+
+		v.resize(size / sizeof(T_));
+		unsigned char* bytes = reinterpret_cast<unsigned char*>(v.data());
+		uint bits = 0;
+		size_t pending = 0;
+		size_t n = 0;
+		for (const char* p = first; p != last && n < size; ++p)
+		{
+			const int d = GetBase64Digit(*p);
+			if (d < 0)
+				continue;
+			bits = (bits << 6) | d;
+			pending += 6;
+			if (pending >= 8)
+			{
+				pending -= 8;
+				bytes[n++] = (unsigned char)(bits >> pending);
+			}
+		}
+		return true;
+	}
+
+private:
+	// How the elements split into formatted values.
+	template <class T_>
+	struct cElement
+	{
+		typedef T_ tScalar;
+		typedef cIntegerText<T_> tText;
+		static const size_t SScalars = 1;
+	};
+
+	static bool IsSpace(char c)
+	{
+		return c == ' ' || (c >= '\t' && c <= '\r');
+	}
+
+	static const char* SkipSpace(const char* p, const char* last)
+	{
+		while (p != last && IsSpace(*p))
+			++p;
+		return p;
+	}
+
+	static const char* SkipToken(const char* p, const char* last)
+	{
+		while (p != last && !IsSpace(*p))
+			++p;
+		return p;
+	}
+
+	static int GetBase64Digit(char c)
+	{
+		if (c >= 'A' && c <= 'Z')
+			return c - 'A';
+		if (c >= 'a' && c <= 'z')
+			return c - 'a' + 26;
+		if (c >= '0' && c <= '9')
+			return c - '0' + 52;
+		if (c == '+')
+			return 62;
+		if (c == '/')
+			return 63;
+		return -1;
+	}
+};
+
+template <>
+struct cArrayText::cElement<float>
+{
+	typedef float tScalar;
+	typedef cFloatText<float> tText;
+	static const size_t SScalars = 1;
+};
+
+template <>
+struct cArrayText::cElement<Vector3>
+{
+	typedef float tScalar;
+	typedef cFloatText<float> tText;
+	static const size_t SScalars = 3;
+};
+
+// Value of string properties. Copies share the text, which is immutable: assigning a new
+// value allocates it once and leaves the other copies alone. Objects copied from a prototype
+// (see cObjectSystem::SetPrototype()) thus hold one buffer per distinct string.
+class cSharedString
+{
+public:
+	cSharedString() {}
+	cSharedString(const char* s) { Assign(s, strlen(s)); }
+	cSharedString(const std::string& s) { Assign(s.data(), s.size()); }
+
+	cSharedString& operator=(const char* s) { Assign(s, strlen(s)); return *this; }
+	cSharedString& operator=(const std::string& s) { Assign(s.data(), s.size()); return *this; }
+
+	void Assign(const char* s, size_t size)
+	{
+		if (size)
+			Text = std::make_shared<const std::string>(s, size);
+		else
+			Text.reset();
+	}
+
+	const std::string& Get() const { return Text ? *Text : SEmpty; }
+	const char* CStr() const { return Get().c_str(); }
+	size_t Size() const { return Text ? Text->size() : 0; }
+
+	// Whether both hold the same buffer.
+	bool IsShared(const cSharedString& other) const { return Text == other.Text; }
+
+	bool operator==(const cSharedString& other) const { return Text == other.Text || Get() == other.Get(); }
+	bool operator!=(const cSharedString& other) const { return !(*this == other); }
+
+private:
+	static const std::string SEmpty;
+
+	std::shared_ptr<const std::string> Text;	// Null for the empty string.
+};
+
+const std::string cSharedString::SEmpty;
+
+class cProperty;
+class cPropertySet;
+class cPropertySchema;
+struct cPropertyDescriptor;
+struct iBaseObject;
+class cBaseObject;
+struct cColumnLayout;
+class cChangeQueue;
+
+// Changed properties of an object: bit i flags the i-th property of its schema, the last bit
+// also covers every property past it.
+typedef uint64 tDirtyMask;
+static const tDirtyMask SAllDirty = ~0ull;
+
+inline tDirtyMask GetDirtyBit(size_t index) { return 1ull << (index < 63 ? index : 63); }
+
+inline uint GetDirtyIndex(tDirtyMask bit)
+{
+	uint index = 0;
+	while (bit >>= 1)
+		++index;
+	return index;
+}
+
+struct cChangeFlags;
+
+// Flags of the objects changed since the last incremental save, in the order of their first
+// change. Flags leaving the list before that, cleared or destroyed, leave nulls behind.
+typedef std::vector<cChangeFlags*> tDirtyList;
+
+// Where the setters of an object's properties flag their changes, see
+// cPropertySet::TrackChanges(). State of one object: copies start clean. Bound property sets
+// keep pointing here, so they follow tracking and observers turned on or off later.
+struct cChangeFlags
+{
+	cChangeFlags() : Dirty(0), Queued(0), Queue(nullptr), Object(nullptr), Dirtied(nullptr), DirtiedIndex(0) {}
+	cChangeFlags(const cChangeFlags&) : Dirty(0), Queued(0), Queue(nullptr), Object(nullptr), Dirtied(nullptr), DirtiedIndex(0) {}
+	cChangeFlags& operator=(const cChangeFlags&) { return *this; }
+	~cChangeFlags() { ClearDirty(); }
+
+	void MarkDirty(tDirtyMask mask)
+	{
+		if (!Dirtied)
+			return;
+		if (!Dirty && mask)
+		{
+			DirtiedIndex = Dirtied->size();
+			Dirtied->push_back(this);
+		}
+		Dirty |= mask;
+	}
+
+	void ClearDirty()
+	{
+		if (Dirty && Dirtied)
+			(*Dirtied)[DirtiedIndex] = nullptr;
+		Dirty = 0;
+	}
+
+	// Starts over, adding the first change to 'dirtied'. Null stops listing changes.
+	void SetDirtied(tDirtyList* dirtied)
+	{
+		ClearDirty();
+		Dirtied = dirtied;
+	}
+
+	tDirtyMask Dirty;		// Read while the object tracks changes, for incremental saves.
+	tDirtyMask Queued;		// Changes in Queue since its last flush.
+	cChangeQueue* Queue;	// Set while the object is observed.
+	iBaseObject* Object;
+	tDirtyList* Dirtied;	// Set while the object tracks changes.
+	size_t DirtiedIndex;
+};
+
+struct iPropertyIterator
+{
+	virtual ~iPropertyIterator() {}
+
+	virtual bool Next() = 0;
+	virtual cProperty& Get() = 0;
+};
+
+struct iIterableProperties
+{
+	typedef std::unique_ptr<iPropertyIterator> rUniquePIterator;
+
+	virtual ~iIterableProperties() {}
+
+	virtual rUniquePIterator CreateIterator() const = 0;
+};
+
+// A property of an object instance: the per-type cPropertyDescriptor bound to the value, be
+// it a member of the object or an element of a column (see cColumnLayout). Cheap to copy and
+// never allocates.
+class cProperty
+{
+public:
+	enum ePropertyType
+	{
+		ePTString = 0,
+		ePTInt,
+		ePTUInt,
+		ePTVector3,
+		ePTCollection,
+		// Stored in binary snapshots, so new types go last.
+		ePTIntArray,
+		ePTUIntArray,
+		ePTFloatArray,
+		ePTVector3Array,
+		ePTTypeCount
+	};
+public:
+	cProperty() : Descriptor(nullptr), Value(nullptr), Changes(nullptr), DirtyBit(0) {}
+	cProperty(const cPropertyDescriptor& descriptor, void* value, cChangeFlags* changes = nullptr, tDirtyMask dirtyBit = 0)
+		: Descriptor(&descriptor)
+		, Value(value)
+		, Changes(changes)
+		, DirtyBit(dirtyBit)
+	{
+	}
+
+	inline const char* GetName() const;
+	inline ePropertyType GetType() const;
+
+	template <typename T_>
+	T_ GetValue() const;
+	template <typename T_>
+	void SetValue(const T_& v);
+	// Array properties take over 'v'.
+	template <typename T_>
+	void SetValue(std::vector<T_>&& v);
+
+	template<class V_>
+	void Accept(V_& visitor);
+
+private:
+	template <typename T_>
+	inline T_& Ref() const;
+
+	inline void MarkDirty() const;
+
+	const cPropertyDescriptor* Descriptor;
+	void* Value;
+	cChangeFlags* Changes;		// Of the owning object, null for values not bound to one.
+	tDirtyMask DirtyBit;
+};
+
+// Per-type description of a single property. Built once per class and shared by all instances.
+struct cPropertyDescriptor
+{
+	const char* Name;
+	cProperty::ePropertyType Type;
+	size_t Offset;					// Member offset from the start of the owning object.
+	const cPropertySchema* Schema;	// Nested schema of ePTCollection properties.
+};
+
+const char* cProperty::GetName() const { return Descriptor->Name; }
+cProperty::ePropertyType cProperty::GetType() const { return Descriptor->Type; }
+
+template <typename T_>
+T_& cProperty::Ref() const
+{
+	return *static_cast<T_*>(Value);
+}
+
+// The property list of a class. Every class exposing properties owns one static schema
+// built from its DescribeProperties(), e.g.:
+//
+//	template <class V_>
+//	static void DescribeProperties(V_& v)
+//	{
+//		cBaseObject::DescribeProperties(v);
+//		v("Health", &cActor::Health);
+//	}
+class cPropertySchema
+{
+public:
+	typedef std::vector<cPropertyDescriptor> tDescriptors;
+
+	template <class C_>
+	static cPropertySchema Build()
+	{
+		cPropertySchema schema;
+		cBuilder<C_> builder(schema.Descriptors);
+		C_::DescribeProperties(builder);
+		return schema;
+	}
+
+	size_t GetSize() const { return Descriptors.size(); }
+	const cPropertyDescriptor& operator[](size_t i) const { assert(i < Descriptors.size()); return Descriptors[i]; }
+
+	// Descriptors are stored contiguously.
+	const cPropertyDescriptor* Begin() const { return Descriptors.data(); }
+	const cPropertyDescriptor* End() const { return Descriptors.data() + Descriptors.size(); }
+
+private:
+	template <class C_>
+	class cBuilder
+	{
+	public:
+		cBuilder(tDescriptors& descriptors) : Descriptors(descriptors) {}
+
+		template <class B_> void operator()(const char* name, int B_::* m) { Add<int>(name, cProperty::ePTInt, m, nullptr); }
+		template <class B_> void operator()(const char* name, uint B_::* m) { Add<uint>(name, cProperty::ePTUInt, m, nullptr); }
+		template <class B_> void operator()(const char* name, Vector3 B_::* m) { Add<Vector3>(name, cProperty::ePTVector3, m, nullptr); }
+		template <class B_> void operator()(const char* name, cSharedString B_::* m) { Add<cSharedString>(name, cProperty::ePTString, m, nullptr); }
+		template <class B_> void operator()(const char* name, tIntArray B_::* m) { Add<tIntArray>(name, cProperty::ePTIntArray, m, nullptr); }
+		template <class B_> void operator()(const char* name, tUIntArray B_::* m) { Add<tUIntArray>(name, cProperty::ePTUIntArray, m, nullptr); }
+		template <class B_> void operator()(const char* name, tFloatArray B_::* m) { Add<tFloatArray>(name, cProperty::ePTFloatArray, m, nullptr); }
+		template <class B_> void operator()(const char* name, tVector3Array B_::* m) { Add<tVector3Array>(name, cProperty::ePTVector3Array, m, nullptr); }
+		template <class T_, class B_> void operator()(const char* name, T_ B_::* m) { Add<T_>(name, cProperty::ePTCollection, m, &T_::SSchema); }
+
+	private:
+		template <class T_>
+		void Add(const char* name, cProperty::ePropertyType type, T_ C_::* m, const cPropertySchema* schema)
+		{
+			// offsetof() equivalent which also works for polymorphic classes (no virtual bases here).
+			typename std::aligned_storage<sizeof(C_), std::alignment_of<C_>::value>::type storage;
+			const C_* object = reinterpret_cast<const C_*>(&storage);
+			const size_t offset = reinterpret_cast<const char*>(&(object->*m)) - reinterpret_cast<const char*>(object);
+
+			cPropertyDescriptor d = { name, type, offset, schema };
+			Descriptors.push_back(d);
+		}
+
+		tDescriptors& Descriptors;
+	};
+
+	tDescriptors Descriptors;
+};
+
+// The columns of an object whose properties live in a storage row (see cColumnFactory),
+// null for objects holding their own and for classes other than cBaseObjects.
+template <class C_>
+inline const cColumnLayout* GetStorageLayout(C_& object, uint& row, std::false_type) { return nullptr; }
+template <class C_>
+inline const cColumnLayout* GetStorageLayout(C_& object, uint& row, std::true_type) { return object.GetStorageLayout(row); }
+template <class C_>
+inline const cColumnLayout* GetStorageLayout(C_& object, uint& row)
+{
+	return GetStorageLayout(object, row, std::is_base_of<cBaseObject, typename std::remove_const<C_>::type>());
+}
+
+// Where the static walks find property 'index' of type T_: the member, or the element of
+// the object's row.
+template <class C_, class T_, class B_>
+class cStaticPropertyAccess
+{
+public:
+	typedef typename std::conditional<std::is_const<C_>::value, const T_, T_>::type tValue;
+
+	static tValue& Get(C_& object, T_ B_::* m, const cColumnLayout* layout, uint row, size_t index)
+	{
+		if (layout)
+			return *reinterpret_cast<tValue*>(layout->Columns[index] + row * layout->Strides[index]);
+		return object.*m;
+	}
+};
+
+// Statically dispatched property walk: calls visitor(name, member) for every property
+// declared by C_::DescribeProperties(), with the member typed as declared. Visitors
+// overload operator() per property type, so each class gets its own fully inlined
+// instantiation with no cProperty::Accept switch. Objects keeping their properties in
+// columns are walked over their row.
+template <class C_, class V_>
+class cStaticPropertyVisit
+{
+public:
+	cStaticPropertyVisit(C_& object, V_& visitor) : Object(object), Visitor(visitor), Row(0), Index(0) { Layout = GetStorageLayout(object, Row); }
+
+	template <class T_, class B_>
+	void operator()(const char* name, T_ B_::* m) { Visitor(name, cStaticPropertyAccess<C_, T_, B_>::Get(Object, m, Layout, Row, Index++)); }
+
+private:
+	cStaticPropertyVisit& operator=(const cStaticPropertyVisit&);
+
+	C_& Object;
+	V_& Visitor;
+	const cColumnLayout* Layout;
+	uint Row;
+	size_t Index;
+};
+
+template <class C_, class V_>
+inline void VisitProperties(C_& object, V_& visitor)
+{
+	cStaticPropertyVisit<C_, V_> visit(object, visitor);
+	C_::DescribeProperties(visit);
+}
+
+// VisitProperties() over two objects of class C_ at once: calls visitor(name, member, other's
+// member) for every property.
+template <class C_, class D_, class V_>
+class cStaticPropertyPairVisit
+{
+public:
+	cStaticPropertyPairVisit(C_& object, D_& other, V_& visitor)
+		: Object(object)
+		, Other(other)
+		, Visitor(visitor)
+		, Row(0)
+		, OtherRow(0)
+		, Index(0)
+	{
+		Layout = GetStorageLayout(object, Row);
+		OtherLayout = GetStorageLayout(other, OtherRow);
+	}
+
+	template <class T_, class B_>
+	void operator()(const char* name, T_ B_::* m)
+	{
+		const size_t index = Index++;
+		Visitor(name, cStaticPropertyAccess<C_, T_, B_>::Get(Object, m, Layout, Row, index), cStaticPropertyAccess<D_, T_, B_>::Get(Other, m, OtherLayout, OtherRow, index));
+	}
+
+private:
+	cStaticPropertyPairVisit& operator=(const cStaticPropertyPairVisit&);
+
+	C_& Object;
+	D_& Other;
+	V_& Visitor;
+	const cColumnLayout* Layout;
+	const cColumnLayout* OtherLayout;
+	uint Row;
+	uint OtherRow;
+	size_t Index;
+};
+
+template <class C_, class D_, class V_>
+inline void VisitPropertyPairs(C_& object, D_& other, V_& visitor)
+{
+	cStaticPropertyPairVisit<C_, D_, V_> visit(object, other, visitor);
+	C_::DescribeProperties(visit);
+}
+
+// Pair visitor copying the values of the other object. Strings end up shared.
+struct cPropertyCopier
+{
+	template <class T_>
+	void operator()(const char* name, T_& v, const T_& other) { v = other; }
+};
+
+// Pair visitor telling whether two objects hold the same values. Floats compare bitwise, so
+// the same values save to the same text.
+class cPropertyComparer
+{
+public:
+	cPropertyComparer() : Same(true) {}
+
+	void operator()(const char* name, const int& v, const int& other) { Same = Same && v == other; }
+	void operator()(const char* name, const uint& v, const uint& other) { Same = Same && v == other; }
+	void operator()(const char* name, const cSharedString& v, const cSharedString& other) { Same = Same && v == other; }
+	void operator()(const char* name, const Vector3& v, const Vector3& other) { Same = Same && memcmp(&v, &other, sizeof(Vector3)) == 0; }
+	template <class T_>
+	void operator()(const char* name, const std::vector<T_>& v, const std::vector<T_>& other)
+	{
+		Same = Same && v.size() == other.size() && (v.empty() || memcmp(v.data(), other.data(), v.size() * sizeof(T_)) == 0);
+	}
+	template <class C_>
+	void operator()(const char* name, const C_& collection, const C_& other)
+	{
+		if (Same)
+			VisitPropertyPairs(collection, other, *this);
+	}
+
+	bool IsSame() const { return Same; }
+
+private:
+	bool Same;
+};
+
+// Column storage of a structure-of-arrays type: property i of row r lives at
+// Columns[i] + r * Strides[i].
+struct cColumnLayout
+{
+	std::vector<char*> Columns;
+	std::vector<size_t> Strides;
+};
+
+// A schema bound to an object instance, or to a row of columns. Iterable with range-for
+// without any allocation or virtual call:
+//
+//	for (cProperty p : object.GetProperties())
+//		p.Accept(visitor);
+//
+// CreateIterator() is kept for iIterableProperties clients.
+class cPropertySet : public iIterableProperties
+{
+public:
+	class cIterator
+	{
+	public:
+		cIterator(const cPropertyDescriptor* descriptor, const cPropertySet& set)
+			: Descriptor(descriptor)
+			, First(set.Schema->Begin())
+			, Object(set.Object)
+			, Layout(set.Layout)
+			, Row(set.Row)
+			, Changes(set.Changes)
+			, DirtyBit(set.DirtyBit)
+		{
+		}
+
+		cProperty operator*() const
+		{
+			const size_t i = Descriptor - First;
+			void* value = Layout ? Layout->Columns[i] + Row * Layout->Strides[i] : static_cast<char*>(Object) + Descriptor->Offset;
+			return cProperty(*Descriptor, value, Changes, DirtyBit ? DirtyBit : GetDirtyBit(i));
+		}
+		cIterator& operator++() { ++Descriptor; return *this; }
+		bool operator==(const cIterator& other) const { return Descriptor == other.Descriptor; }
+		bool operator!=(const cIterator& other) const { return Descriptor != other.Descriptor; }
+
+	private:
+		const cPropertyDescriptor* Descriptor;
+		const cPropertyDescriptor* First;
+		void* Object;
+		const cColumnLayout* Layout;
+		size_t Row;
+		cChangeFlags* Changes;
+		tDirtyMask DirtyBit;
+	};
+
+public:
+	template <class C_>
+	explicit cPropertySet(C_* object) : Schema(&C_::SSchema), Object(object), Layout(nullptr), Row(0), Changes(nullptr), DirtyBit(0) {}
+	cPropertySet(const cPropertySchema& schema, void* object) : Schema(&schema), Object(object), Layout(nullptr), Row(0), Changes(nullptr), DirtyBit(0) {}
+	cPropertySet(const cPropertySchema& schema, const cColumnLayout& layout, size_t row) : Schema(&schema), Object(nullptr), Layout(&layout), Row(row), Changes(nullptr), DirtyBit(0) {}
+
+	// Setters of the properties flag their changes in 'changes', each with its own bit or,
+	// for the members of a collection, with the collection's 'bit'.
+	void TrackChanges(cChangeFlags* changes, tDirtyMask bit = 0)
+	{
+		Changes = changes;
+		DirtyBit = bit;
+	}
+
+	// iIterableProperties:
+	virtual rUniquePIterator CreateIterator() const override { return rUniquePIterator(new cLegacyIterator(begin(), end())); }
+	// iIterableProperties.
+
+	cIterator begin() const { return cIterator(Schema->Begin(), *this); }
+	cIterator end() const { return cIterator(Schema->End(), *this); }
+	size_t size() const { return Schema->GetSize(); }
+
+	const cPropertySchema& GetSchema() const { return *Schema; }
+	// Null for a row of columns: use GetValue() there, values are not at schema offsets.
+	void* GetObject() const { return Object; }
+	// Where the i-th property's value lives.
+	void* GetValue(size_t i) const
+	{
+		return Layout ? Layout->Columns[i] + Row * Layout->Strides[i] : static_cast<char*>(Object) + (*Schema)[i].Offset;
+	}
+
+private:
+	class cLegacyIterator : public iPropertyIterator
+	{
+	public:
+		cLegacyIterator(cIterator first, cIterator last) : Position(first), Last(last) {}
+
+		// iPropertyIterator:
+		virtual bool Next() override
+		{
+			if (Position == Last)
+				return false;
+			Current = *Position;
+			++Position;
+			return true;
+		}
+		virtual cProperty& Get() override { return Current; }
+		// iPropertyIterator.
+
+	private:
+		cIterator Position;
+		cIterator Last;
+		cProperty Current;
+	};
+
+private:
+	const cPropertySchema* Schema;
+	void* Object;
+	const cColumnLayout* Layout;
+	size_t Row;
+	cChangeFlags* Changes;
+	tDirtyMask DirtyBit;
+};
+
+// A property of an observed object written since the last flush, see
+// cObjectSystem::AddObserver(). 'Property' is its index in the object's schema; members of
+// collections report their collection, and index 63 stands for every property from 63 on,
+// as in tDirtyMask.
+struct cPropertyChange
+{
+	iBaseObject* Object;
+	uint Property;
+};
+
+struct iPropertyObserver
+{
+	virtual ~iPropertyObserver() {}
+
+	// 'changes' holds each written property once, grouped by writing thread.
+	virtual void OnPropertiesChanged(const cPropertyChange* changes, size_t count) = 0;
+};
+
+// Writes to observed objects, coalesced until Flush(). The first write of a property since
+// the last flush appends a record to the writing thread's buffer and sets the property's bit
+// in the object's Queued mask; writes finding the bit set cost nothing more. Writes may come
+// from any thread, Flush() and Forget() only between them. The Queued mask, like the Dirty
+// one, is updated without atomics: the properties of one object are written from one thread
+// at a time between flushes.
+class cChangeQueue
+{
+public:
+	cChangeQueue() : Serial(++SSerial) {}
+
+	void Push(cChangeFlags& changes, tDirtyMask bit)
+	{
+		changes.Queued |= bit;
+		cRecord record = { &changes, changes.Object, bit };
+		GetBuffer().push_back(record);
+	}
+
+	// Drops the records of 'object', about to be destroyed. Only notes where the buffers
+	// end now: Flush() skips the records of the object up to there, so one that reuses
+	// its address is still reported.
+	void Forget(const iBaseObject& object)
+	{
+		cForgotten forgotten = { &object, ForgottenEnds.size(), Buffers.size() };
+		Forgotten.push_back(forgotten);
+		for (auto& buffer : Buffers)
+			ForgottenEnds.push_back(buffer.second->Records.size());
+	}
+
+	// Hands the records since the last flush to 'observers' in one batch and starts over.
+	// Writes from the observers go to the next batch. Returns the number of records.
+	size_t Flush(const std::vector<iPropertyObserver*>& observers)
+	{
+		// The last time each address was forgotten tells its dead records.
+		Dead.clear();
+		for (size_t f = 0; f < Forgotten.size(); ++f)
+			Dead[Forgotten[f].Object] = f;
+
+		Batch.clear();
+		for (size_t b = 0; b < Buffers.size(); ++b)
+		{
+			auto& records = Buffers[b].second->Records;
+			for (size_t i = 0; i < records.size(); ++i)
+			{
+				const cRecord& r = records[i];
+				if (!Dead.empty())
+				{
+					auto dead = Dead.find(r.Object);
+					if (dead != Dead.end() && IsForgotten(Forgotten[dead->second], b, i))
+						continue;
+				}
+				r.Changes->Queued = 0;
+				cPropertyChange change = { r.Object, GetDirtyIndex(r.Bit) };
+				Batch.push_back(change);
+			}
+			records.clear();
+		}
+		Forgotten.clear();
+		ForgottenEnds.clear();
+		if (!Batch.empty())
+			for (auto observer : observers)
+				observer->OnPropertiesChanged(Batch.data(), Batch.size());
+		return Batch.size();
+	}
+
+private:
+	cChangeQueue(const cChangeQueue&);
+	cChangeQueue& operator=(const cChangeQueue&);
+
+	struct cRecord
+	{
+		cChangeFlags* Changes;
+		iBaseObject* Object;
+		tDirtyMask Bit;
+	};
+
+	// Ends of the first 'Buffers' buffers when 'Object' was forgotten, from
+	// ForgottenEnds[Ends] on. Buffers added later had nothing of it.
+	struct cForgotten
+	{
+		const iBaseObject* Object;
+		size_t Ends;
+		size_t Buffers;
+	};
+
+	bool IsForgotten(const cForgotten& forgotten, size_t buffer, size_t record) const
+	{
+		return buffer < forgotten.Buffers && record < ForgottenEnds[forgotten.Ends + buffer];
+	}
+
+	struct cBuffer
+	{
+		std::vector<cRecord> Records;
+	};
+
+	// The calling thread's buffer. The last one used is cached per thread along with the
+	// serial of its queue, which is never reused as an address may be.
+	std::vector<cRecord>& GetBuffer()
+	{
+		static PTREE_THREAD_LOCAL cBuffer* current = nullptr;
+		static PTREE_THREAD_LOCAL uint64 currentSerial = 0;
+		if (currentSerial != Serial)
+		{
+			const std::thread::id thread = std::this_thread::get_id();
+			std::lock_guard<std::mutex> lock(Mutex);
+			current = nullptr;
+			for (auto& buffer : Buffers)
+				if (buffer.first == thread)
+					current = buffer.second.get();
+			if (!current)
+			{
+				Buffers.push_back(std::make_pair(thread, std::unique_ptr<cBuffer>(new cBuffer)));
+				current = Buffers.back().second.get();
+			}
+			currentSerial = Serial;
+		}
+		return current->Records;
+	}
+
+	static std::atomic<uint64> SSerial;
+
+	const uint64 Serial;
+	std::mutex Mutex;
+	std::vector<std::pair<std::thread::id, std::unique_ptr<cBuffer>>> Buffers;
+	std::vector<cForgotten> Forgotten;
+	std::vector<size_t> ForgottenEnds;
+	std::unordered_map<const iBaseObject*, size_t> Dead;
+	std::vector<cPropertyChange> Batch;
+};
+
+std::atomic<uint64> cChangeQueue::SSerial(0);
+
+void cProperty::MarkDirty() const
+{
+	if (Changes)
+	{
+		Changes->MarkDirty(DirtyBit);
+		if (Changes->Queue && !(Changes->Queued & DirtyBit))
+			Changes->Queue->Push(*Changes, DirtyBit);
+	}
+}
+
+template<> int cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTInt);
+	return Ref<int>();
+}
+
+template<> void cProperty::SetValue(const int& v)
+{
+	assert(GetType() == cProperty::ePTInt);
+	Ref<int>() = v;
+	MarkDirty();
+}
+
+template<> uint cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTUInt);
+	return Ref<uint>();
+}
+
+template<> void cProperty::SetValue(const uint& v)
+{
+	assert(GetType() == cProperty::ePTUInt);
+	Ref<uint>() = v;
+	MarkDirty();
+}
+
+template<> const char* cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTString);
+	return Ref<cSharedString>().CStr();
+}
+
+template<> void cProperty::SetValue(const char* const& v)
+{
+	assert(GetType() == cProperty::ePTString);
+	Ref<cSharedString>() = v;
+	MarkDirty();
+}
+
+template<> const Vector3& cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTVector3);
+	return Ref<Vector3>();
+}
+
+template<> void cProperty::SetValue(const Vector3& v)
+{
+	assert(GetType() == cProperty::ePTVector3);
+	Ref<Vector3>() = v;
+	MarkDirty();
+}
+
+template<> const tIntArray& cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTIntArray);
+	return Ref<tIntArray>();
+}
+
+template<> void cProperty::SetValue(const tIntArray& v)
+{
+	assert(GetType() == cProperty::ePTIntArray);
+	Ref<tIntArray>() = v;
+	MarkDirty();
+}
+
+template<> const tUIntArray& cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTUIntArray);
+	return Ref<tUIntArray>();
+}
+
+template<> void cProperty::SetValue(const tUIntArray& v)
+{
+	assert(GetType() == cProperty::ePTUIntArray);
+	Ref<tUIntArray>() = v;
+	MarkDirty();
+}
+
+template<> const tFloatArray& cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTFloatArray);
+	return Ref<tFloatArray>();
+}
+
+template<> void cProperty::SetValue(const tFloatArray& v)
+{
+	assert(GetType() == cProperty::ePTFloatArray);
+	Ref<tFloatArray>() = v;
+	MarkDirty();
+}
+
+template<> const tVector3Array& cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTVector3Array);
+	return Ref<tVector3Array>();
+}
+
+template<> void cProperty::SetValue(const tVector3Array& v)
+{
+	assert(GetType() == cProperty::ePTVector3Array);
+	Ref<tVector3Array>() = v;
+	MarkDirty();
+}
+
+template<> cPropertySet cProperty::GetValue() const
+{
+	assert(GetType() == cProperty::ePTCollection);
+	cPropertySet properties(*Descriptor->Schema, &Ref<char>());
+	properties.TrackChanges(Changes, DirtyBit);
+	return properties;
+}
+
+// Property type of a member type, for typed access checks.
+template <class T_> struct cPropertyTypeOf;
+template <> struct cPropertyTypeOf<int> { static const cProperty::ePropertyType SType = cProperty::ePTInt; };
+template <> struct cPropertyTypeOf<uint> { static const cProperty::ePropertyType SType = cProperty::ePTUInt; };
+template <> struct cPropertyTypeOf<cSharedString> { static const cProperty::ePropertyType SType = cProperty::ePTString; };
+template <> struct cPropertyTypeOf<Vector3> { static const cProperty::ePropertyType SType = cProperty::ePTVector3; };
+template <> struct cPropertyTypeOf<tIntArray> { static const cProperty::ePropertyType SType = cProperty::ePTIntArray; };
+template <> struct cPropertyTypeOf<tUIntArray> { static const cProperty::ePropertyType SType = cProperty::ePTUIntArray; };
+template <> struct cPropertyTypeOf<tFloatArray> { static const cProperty::ePropertyType SType = cProperty::ePTFloatArray; };
+template <> struct cPropertyTypeOf<tVector3Array> { static const cProperty::ePropertyType SType = cProperty::ePTVector3Array; };
+
+template <typename T_>
+void cProperty::SetValue(std::vector<T_>&& v)
+{
+	assert(GetType() == cPropertyTypeOf<std::vector<T_>>::SType);
+	Ref<std::vector<T_>>() = std::move(v);
+	MarkDirty();
+}
+
+template<class V_>
+void cProperty::Accept(V_& visitor)
+{
+	switch (GetType())
+	{
+	case cProperty::ePTInt: visitor.template Visit<ePTInt>(*this); break;
+	case cProperty::ePTUInt: visitor.template Visit<ePTUInt>(*this); break;
+	case cProperty::ePTString: visitor.template Visit<ePTString>(*this); break;
+	case cProperty::ePTVector3: visitor.template Visit<ePTVector3>(*this); break;
+	case cProperty::ePTCollection: visitor.template Visit<ePTCollection>(*this); break;
+	case cProperty::ePTIntArray: visitor.template Visit<ePTIntArray>(*this); break;
+	case cProperty::ePTUIntArray: visitor.template Visit<ePTUIntArray>(*this); break;
+	case cProperty::ePTFloatArray: visitor.template Visit<ePTFloatArray>(*this); break;
+	case cProperty::ePTVector3Array: visitor.template Visit<ePTVector3Array>(*this); break;
+	default: assert(false);
+	}
+}
+
+template <class T_>
+bool IsSameArray(const std::vector<T_>& v, const std::vector<T_>& other)
+{
+	return v.size() == other.size() && (v.empty() || memcmp(v.data(), other.data(), v.size() * sizeof(T_)) == 0);
+}
+
+// Sets the properties of 'live' whose values differ between 'previous' and 'current', two
+// loaded states of the object, through the properties' setters. All three share a schema;
+// collections are compared member by member, Vector3 values and arrays bitwise. Returns the
+// number of values set.
+inline size_t SetChangedProperties(const cPropertySet& live, const cPropertySet& previous, const cPropertySet& current)
+{
+	size_t count = 0;
+	cPropertySet::cIterator p = previous.begin();
+	cPropertySet::cIterator c = current.begin();
+	for (cProperty l : live)
+	{
+		const cProperty from = *p;
+		const cProperty to = *c;
+		++p;
+		++c;
+		bool changed = false;
+		switch (l.GetType())
+		{
+		case cProperty::ePTInt: changed = from.GetValue<int>() != to.GetValue<int>(); break;
+		case cProperty::ePTUInt: changed = from.GetValue<uint>() != to.GetValue<uint>(); break;
+		case cProperty::ePTString: changed = strcmp(from.GetValue<const char*>(), to.GetValue<const char*>()) != 0; break;
+		case cProperty::ePTVector3: changed = memcmp(&from.GetValue<const Vector3&>(), &to.GetValue<const Vector3&>(), sizeof(Vector3)) != 0; break;
+		case cProperty::ePTCollection:
+			count += SetChangedProperties(l.GetValue<cPropertySet>(), from.GetValue<cPropertySet>(), to.GetValue<cPropertySet>());
+			break;
+		case cProperty::ePTIntArray: changed = !IsSameArray(from.GetValue<const tIntArray&>(), to.GetValue<const tIntArray&>()); break;
+		case cProperty::ePTUIntArray: changed = !IsSameArray(from.GetValue<const tUIntArray&>(), to.GetValue<const tUIntArray&>()); break;
+		case cProperty::ePTFloatArray: changed = !IsSameArray(from.GetValue<const tFloatArray&>(), to.GetValue<const tFloatArray&>()); break;
+		case cProperty::ePTVector3Array: changed = !IsSameArray(from.GetValue<const tVector3Array&>(), to.GetValue<const tVector3Array&>()); break;
+		default: assert(false);
+		}
+		if (!changed)
+			continue;
+		switch (l.GetType())
+		{
+		case cProperty::ePTInt: l.SetValue(to.GetValue<int>()); break;
+		case cProperty::ePTUInt: l.SetValue(to.GetValue<uint>()); break;
+		case cProperty::ePTString: l.SetValue(to.GetValue<const char*>()); break;
+		case cProperty::ePTVector3: l.SetValue(to.GetValue<const Vector3&>()); break;
+		case cProperty::ePTIntArray: l.SetValue(to.GetValue<const tIntArray&>()); break;
+		case cProperty::ePTUIntArray: l.SetValue(to.GetValue<const tUIntArray&>()); break;
+		case cProperty::ePTFloatArray: l.SetValue(to.GetValue<const tFloatArray&>()); break;
+		case cProperty::ePTVector3Array: l.SetValue(to.GetValue<const tVector3Array&>()); break;
+		default: break;
+		}
+		++count;
+	}
+	return count;
+}
+
+// Problems met by lenient loads, see cObjectSystem::SetLoadDiagnostics(). What a lenient
+// deserializer cannot read is reported here instead of thrown, and the property keeps its
+// value. Add() is thread safe, the rest is for after the load.
+class cLoadDiagnostics
+{
+public:
+	enum eReason
+	{
+		eMissing = 0,	// No element for the property.
+		eBadData,		// Its data does not convert to the property's type.
+		eBadPrototype	// Unknown, of another type or in a cycle: loaded without it.
+	};
+
+	struct cDiagnostic
+	{
+		size_t Object;			// Position among the objects of the loaded document.
+		std::string Property;	// Path from the object, e.g. "Position.x".
+		eReason Reason;
+	};
+
+	void Add(size_t object, const std::string& property, eReason reason)
+	{
+		cDiagnostic d = { object, property, reason };
+		std::lock_guard<std::mutex> lock(Mutex);
+		Diagnostics.push_back(d);
+	}
+
+	// Orders the diagnostics from 'first' on by object, keeping the order of each object's.
+	void Sort(size_t first)
+	{
+		std::stable_sort(Diagnostics.begin() + first, Diagnostics.end(), [](const cDiagnostic& a, const cDiagnostic& b) { return a.Object < b.Object; });
+	}
+
+	const std::vector<cDiagnostic>& Get() const { return Diagnostics; }
+	void Clear() { Diagnostics.clear(); }
+
+	static const char* GetText(eReason reason)
+	{
+		switch (reason)
+		{
+		case eMissing: return "missing";
+		case eBadData: return "invalid value";
+		case eBadPrototype: return "invalid prototype";
+		default: return "";
+		}
+	}
+
+private:
+	std::mutex Mutex;
+	std::vector<cDiagnostic> Diagnostics;
+};
+
+// Where a deserializer reports: strict scopes throw the ptree exceptions ptree::get() would,
+// lenient ones report to cLoadDiagnostics with the object and the path down to the element.
+// Paths are only built for reports.
+class cLoadScope
+{
+public:
+	cLoadScope() : Diagnostics(nullptr), Object(0), Parent(nullptr), Name(nullptr) {}
+	cLoadScope(cLoadDiagnostics& diagnostics, size_t object) : Diagnostics(&diagnostics), Object(object), Parent(nullptr), Name(nullptr) {}
+	// Scope of the child element 'name'.
+	cLoadScope(const cLoadScope& parent, const char* name) : Diagnostics(parent.Diagnostics), Object(parent.Object), Parent(&parent), Name(name) {}
+
+	bool IsLenient() const { return Diagnostics != nullptr; }
+
+	void Report(const char* name, cLoadDiagnostics::eReason reason) const
+	{
+		std::string path = name;
+		for (const cLoadScope* scope = this; scope->Parent; scope = scope->Parent)
+			path = std::string(scope->Name) + '.' + path;
+		Diagnostics->Add(Object, path, reason);
+	}
+
+private:
+	cLoadDiagnostics* Diagnostics;
+	size_t Object;
+	const cLoadScope* Parent;
+	const char* Name;
+};
+
+// ptree::get() of a strict scope, or reporting to a lenient one and leaving 'v' alone. True
+// when 'v' has been read.
+template <class T_>
+bool GetXMLValue(const tBoostPTree& pt, const char* name, const cLoadScope& scope, T_& v)
+{
+	if (!scope.IsLenient())
+	{
+		v = pt.get<T_>(name);
+		return true;
+	}
+	boost::optional<const tBoostPTree&> child = pt.get_child_optional(name);
+	if (!child)
+	{
+		scope.Report(name, cLoadDiagnostics::eMissing);
+		return false;
+	}
+	boost::optional<T_> value = child->get_value_optional<T_>();
+	if (!value)
+	{
+		scope.Report(name, cLoadDiagnostics::eBadData);
+		return false;
+	}
+	v = *value;
+	return true;
+}
+
+// ptree::get_child() likewise; null for a reported child.
+inline const tBoostPTree* GetXMLChild(const tBoostPTree& pt, const char* name, const cLoadScope& scope)
+{
+	if (!scope.IsLenient())
+		return &pt.get_child(name);
+	boost::optional<const tBoostPTree&> child = pt.get_child_optional(name);
+	if (!child)
+		scope.Report(name, cLoadDiagnostics::eMissing);
+	return child.get_ptr();
+}
+
+// Element body of an array property, see cArrayText. 'encoding' is the element's encoding
+// attribute, empty without one. False for malformed data or unknown encodings.
+template <class T_>
+bool TryParseXMLArray(const std::string& data, const std::string& encoding, std::vector<T_>& v)
+{
+	if (encoding.empty())
+		return cArrayText::Parse(data.data(), data.data() + data.size(), v);
+	if (encoding == "base64")
+		return cArrayText::ParseBase64(data.data(), data.data() + data.size(), v);
+	return false;
+}
+
+// TryParseXMLArray() of the element 'name' of 'scope': strict failures throw ptree_bad_data
+// like ptree::get() does, lenient ones return false and keep 'v' as it was.
+template <class T_>
+bool ParseXMLArray(const std::string& data, const std::string& encoding, const char* name, const cLoadScope& scope, std::vector<T_>& v)
+{
+	std::vector<T_> parsed;
+	if (TryParseXMLArray(data, encoding, parsed))
+	{
+		v.swap(parsed);
+		return true;
+	}
+	if (!scope.IsLenient())
+		BOOST_PROPERTY_TREE_THROW(boost::property_tree::ptree_bad_data(std::string("conversion of data to type \"") + typeid(std::vector<T_>).name() + "\" failed", data));
+	scope.Report(name, cLoadDiagnostics::eBadData);
+	return false;
+}
+
+// Array properties in a ptree: put as packed text, read as text or base64, the attribute
+// being where read_xml() puts it.
+template <class T_>
+void PutXMLArray(tBoostPTree& pt, const char* name, const std::vector<T_>& v)
+{
+	std::string text;
+	cArrayText::Format(v, text);
+	pt.put<std::string>(name, text);
+}
+
+// False, keeping 'v', when the element is missing or, under a lenient 'scope', malformed.
+template <class T_>
+bool GetXMLArray(const tBoostPTree& pt, const char* name, const cLoadScope& scope, std::vector<T_>& v)
+{
+	if (const tBoostPTree* child = GetXMLChild(pt, name, scope))
+		return ParseXMLArray(child->data(), child->get<std::string>("<xmlattr>.encoding", ""), name, scope, v);
+	return false;
+}
+
+class cXMLSerializer
+{
+public:
+	cXMLSerializer(tBoostPTree& pt, const cPropertySet& properties);
+	cXMLSerializer(tBoostPTree& pt, iPropertyIterator& iter);
+
+	template <cProperty::ePropertyType T_>
+	void Visit(cProperty& p);
+
+private:
+	template <class T_>
+	void PutArray(cProperty& p) { PutXMLArray(PT, p.GetName(), p.GetValue<const std::vector<T_>&>()); }
+
+	tBoostPTree& PT;
+};
+
+cXMLSerializer::cXMLSerializer(tBoostPTree& pt, const cPropertySet& properties)
+	: PT(pt)
+{
+	for (cProperty p : properties)
+		p.Accept(*this);
+}
+
+cXMLSerializer::cXMLSerializer(tBoostPTree& pt, iPropertyIterator& iter)
+	: PT(pt)
+{
+	while (iter.Next())
+		iter.Get().Accept(*this);
+}
+
+template<> void cXMLSerializer::Visit<cProperty::ePTInt>(cProperty& p)
+{
+	PT.put<int>(p.GetName(), p.GetValue<int>());
+}
+
+template<> void cXMLSerializer::Visit<cProperty::ePTUInt>(cProperty& p)
+{
+	PT.put<uint>(p.GetName(), p.GetValue<uint>());
+}
+
+template<> void cXMLSerializer::Visit<cProperty::ePTString>(cProperty& p)
+{
+	PT.put<std::string>(p.GetName(), p.GetValue<const char*>());
+}
+
+template<> void cXMLSerializer::Visit<cProperty::ePTVector3>(cProperty& p)
+{
+	const Vector3& v = p.GetValue<const Vector3&>();
+	tBoostPTree pt;
+	pt.put<float>("x", v.X);
+	pt.put<float>("y", v.Y);
+	pt.put<float>("z", v.Z);
+	PT.add_child(p.GetName(), pt);
+}
+
+template<> void cXMLSerializer::Visit<cProperty::ePTCollection>(cProperty& p)
+{
+	tBoostPTree pt;
+	cXMLSerializer(pt, p.GetValue<cPropertySet>());
+	PT.add_child(p.GetName(), pt);
+}
+
+template<> void cXMLSerializer::Visit<cProperty::ePTIntArray>(cProperty& p) { PutArray<int>(p); }
+template<> void cXMLSerializer::Visit<cProperty::ePTUIntArray>(cProperty& p) { PutArray<uint>(p); }
+template<> void cXMLSerializer::Visit<cProperty::ePTFloatArray>(cProperty& p) { PutArray<float>(p); }
+template<> void cXMLSerializer::Visit<cProperty::ePTVector3Array>(cProperty& p) { PutArray<Vector3>(p); }
+
+// Properties the ptree has no or bad data for throw, or under a lenient 'scope' are reported
+// and keep their values.
+class cXMLDeserializer
+{
+public:
+	cXMLDeserializer(const tBoostPTree& pt, const cPropertySet& properties, const cLoadScope& scope = cLoadScope());
+	cXMLDeserializer(const tBoostPTree& pt, iPropertyIterator& iter, const cLoadScope& scope = cLoadScope());
+
+	template <cProperty::ePropertyType T_>
+	void Visit(cProperty& p);
+
+private:
+	template <class T_>
+	void GetValue(cProperty& p)
+	{
+		T_ v = p.GetValue<T_>();
+		if (GetXMLValue(PT, p.GetName(), Scope, v))
+			p.SetValue(v);
+	}
+
+	template <class T_>
+	void GetArray(cProperty& p)
+	{
+		std::vector<T_> parsed;
+		if (GetXMLArray(PT, p.GetName(), Scope, parsed))
+			p.SetValue(std::move(parsed));
+	}
+
+	const tBoostPTree& PT;
+	const cLoadScope Scope;
+};
+
+cXMLDeserializer::cXMLDeserializer(const tBoostPTree& pt, const cPropertySet& properties, const cLoadScope& scope)
+	: PT(pt)
+	, Scope(scope)
+{
+	for (cProperty p : properties)
+		p.Accept(*this);
+}
+
+cXMLDeserializer::cXMLDeserializer(const tBoostPTree& pt, iPropertyIterator& iter, const cLoadScope& scope)
+	: PT(pt)
+	, Scope(scope)
+{
+	while (iter.Next())
+		iter.Get().Accept(*this);
+}
+
+template<> void cXMLDeserializer::Visit<cProperty::ePTInt>(cProperty& p) { GetValue<int>(p); }
+template<> void cXMLDeserializer::Visit<cProperty::ePTUInt>(cProperty& p) { GetValue<uint>(p); }
+
+template<> void cXMLDeserializer::Visit<cProperty::ePTString>(cProperty& p)
+{
+	std::string v;
+	if (GetXMLValue(PT, p.GetName(), Scope, v))
+		p.SetValue(v.c_str());
+}
+
+template<> void cXMLDeserializer::Visit<cProperty::ePTVector3>(cProperty& p)
+{
+	if (const tBoostPTree* pt = GetXMLChild(PT, p.GetName(), Scope))
+	{
+		cLoadScope scope(Scope, p.GetName());
+		Vector3 v = p.GetValue<const Vector3&>();
+		GetXMLValue(*pt, "x", scope, v.X);
+		GetXMLValue(*pt, "y", scope, v.Y);
+		GetXMLValue(*pt, "z", scope, v.Z);
+		p.SetValue(v);
+	}
+}
+
+template<> void cXMLDeserializer::Visit<cProperty::ePTCollection>(cProperty& p)
+{
+	if (const tBoostPTree* pt = GetXMLChild(PT, p.GetName(), Scope))
+		cXMLDeserializer(*pt, p.GetValue<cPropertySet>(), cLoadScope(Scope, p.GetName()));
+}
+
+template<> void cXMLDeserializer::Visit<cProperty::ePTIntArray>(cProperty& p) { GetArray<int>(p); }
+template<> void cXMLDeserializer::Visit<cProperty::ePTUIntArray>(cProperty& p) { GetArray<uint>(p); }
+template<> void cXMLDeserializer::Visit<cProperty::ePTFloatArray>(cProperty& p) { GetArray<float>(p); }
+template<> void cXMLDeserializer::Visit<cProperty::ePTVector3Array>(cProperty& p) { GetArray<Vector3>(p); }
+
+// Static counterparts of cXMLSerializer/cXMLDeserializer, driven by VisitProperties().
+class cStaticXMLSerializer
+{
+public:
+	cStaticXMLSerializer(tBoostPTree& pt) : PT(pt) {}
+
+	void operator()(const char* name, const int& v) { PT.put<int>(name, v); }
+	void operator()(const char* name, const uint& v) { PT.put<uint>(name, v); }
+	void operator()(const char* name, const cSharedString& v) { PT.put<std::string>(name, v.Get()); }
+	void operator()(const char* name, const Vector3& v)
+	{
+		tBoostPTree pt;
+		pt.put<float>("x", v.X);
+		pt.put<float>("y", v.Y);
+		pt.put<float>("z", v.Z);
+		PT.add_child(name, pt);
+	}
+	template <class T_>
+	void operator()(const char* name, const std::vector<T_>& v) { PutXMLArray(PT, name, v); }
+	template <class C_>
+	void operator()(const char* name, const C_& collection)
+	{
+		tBoostPTree pt;
+		cStaticXMLSerializer saver(pt);
+		VisitProperties(collection, saver);
+		PT.add_child(name, pt);
+	}
+
+private:
+	tBoostPTree& PT;
+};
+
+class cStaticXMLDeserializer
+{
+public:
+	cStaticXMLDeserializer(const tBoostPTree& pt, const cLoadScope& scope = cLoadScope()) : PT(pt), Scope(scope) {}
+
+	void operator()(const char* name, int& v) { GetXMLValue(PT, name, Scope, v); }
+	void operator()(const char* name, uint& v) { GetXMLValue(PT, name, Scope, v); }
+	void operator()(const char* name, cSharedString& v)
+	{
+		std::string s;
+		if (GetXMLValue(PT, name, Scope, s))
+			v = s;
+	}
+	void operator()(const char* name, Vector3& v)
+	{
+		if (const tBoostPTree* pt = GetXMLChild(PT, name, Scope))
+		{
+			cLoadScope scope(Scope, name);
+			GetXMLValue(*pt, "x", scope, v.X);
+			GetXMLValue(*pt, "y", scope, v.Y);
+			GetXMLValue(*pt, "z", scope, v.Z);
+		}
+	}
+	template <class T_>
+	void operator()(const char* name, std::vector<T_>& v) { GetXMLArray(PT, name, Scope, v); }
+	template <class C_>
+	void operator()(const char* name, C_& collection)
+	{
+		if (const tBoostPTree* pt = GetXMLChild(PT, name, Scope))
+		{
+			cStaticXMLDeserializer loader(*pt, cLoadScope(Scope, name));
+			VisitProperties(collection, loader);
+		}
+	}
+
+private:
+	const tBoostPTree& PT;
+	const cLoadScope Scope;
+};
+
+// Buffered XML output producing exactly what write_xml() produces for the equivalent ptree
+// with default writer settings. Without a file it collects a fragment in memory, to be
+// Append()ed to another writer.
+class cXMLWriter
+{
+public:
+	cXMLWriter()
+		: Handle(nullptr)
+		, Pending(false)
+		, Base64Arrays(false)
+	{
+	}
+
+	explicit cXMLWriter(const char* file)
+		: File(file)
+		, Handle(fopen(file, "w"))
+		, Pending(false)
+		, Base64Arrays(false)
+	{
+		if (!Handle)
+			BOOST_PROPERTY_TREE_THROW(boost::property_tree::xml_parser_error("cannot open file", File, 0));
+		Buffer.reserve(SBufferSize + SBufferSize / 4);
+		Raw("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+	}
+
+	~cXMLWriter()
+	{
+		if (Handle)
+			fclose(Handle);
+	}
+
+	// Element with children: Begin(key), children, End(key). Childless elements end up as <key/>.
+	void Begin(const char* key)
+	{
+		ResolvePending();
+		Buffer += '<';
+		Buffer += key;
+		Pending = true;
+	}
+
+	void End(const char* key)
+	{
+		if (Pending)
+		{
+			Buffer += "/>";
+			Pending = false;
+		}
+		else
+		{
+			Buffer += "</";
+			Buffer += key;
+			Buffer += '>';
+		}
+		FlushIfFull();
+	}
+
+	// Attribute of the element just begun, before its children. 'value' needs no escaping.
+	void Attribute(const char* name, const char* value)
+	{
+		assert(Pending);
+		Buffer += ' ';
+		Buffer += name;
+		Buffer += "=\"";
+		Buffer += value;
+		Buffer += '"';
+	}
+
+	// Leaf element holding 'value'.
+	void Value(const char* key, const std::string& value)
+	{
+		Begin(key);
+		Text(value);
+		End(key);
+	}
+
+	// Character data of the element just begun.
+	void Text(const std::string& value)
+	{
+		if (!value.empty())
+		{
+			ResolvePending();
+			Encode(value);
+		}
+	}
+
+	// Appends the top level elements collected by a fragment writer.
+	void Append(const cXMLWriter& fragment)
+	{
+		assert(!fragment.Pending);
+		ResolvePending();
+		Buffer += fragment.Buffer;
+		FlushIfFull();
+	}
+
+	// Drops the collected output of a fragment writer.
+	void Clear()
+	{
+		assert(!Handle);
+		Buffer.clear();
+		Pending = false;
+	}
+
+	// Array properties go out as base64 instead of text, see WriteXMLArray().
+	void SetBase64Arrays(bool enable) { Base64Arrays = enable; }
+	bool GetBase64Arrays() const { return Base64Arrays; }
+
+	// Writes the remaining buffered output and reports write errors.
+	void Finish()
+	{
+		Flush();
+		const bool failed = ferror(Handle) != 0;
+		fclose(Handle);
+		Handle = nullptr;
+		if (failed)
+			BOOST_PROPERTY_TREE_THROW(boost::property_tree::xml_parser_error("write error", File, 0));
+	}
+
+private:
+	static const size_t SBufferSize = 1 << 20;
+
+	void Raw(const char* s) { Buffer += s; }
+
+	void ResolvePending()
+	{
+		if (Pending)
+		{
+			Buffer += '>';
+			Pending = false;
+		}
+	}
+
+	// Same escaping as xml_parser::encode_char_entities().
+	void Encode(const std::string& s)
+	{
+		if (s.find_first_not_of(' ') == std::string::npos)
+		{
+			Buffer += "&#32;";
+			Buffer.append(s.size() - 1, ' ');
+			return;
+		}
+		for (char c : s)
+		{
+			switch (c)
+			{
+			case '<': Buffer += "&lt;"; break;
+			case '>': Buffer += "&gt;"; break;
+			case '&': Buffer += "&amp;"; break;
+			case '"': Buffer += "&quot;"; break;
+			case '\'': Buffer += "&apos;"; break;
+			case '\t': Buffer += "&#9;"; break;
+			case '\n': Buffer += "&#10;"; break;
+			default: Buffer += c; break;
+			}
+		}
+	}
+
+	void FlushIfFull()
+	{
+		if (Handle && Buffer.size() >= SBufferSize)
+			Flush();
+	}
+
+	void Flush()
+	{
+		fwrite(Buffer.data(), 1, Buffer.size(), Handle);
+		Buffer.clear();
+	}
+
+	const std::string File;
+	FILE* Handle;
+	std::string Buffer;
+	bool Pending;
+	bool Base64Arrays;
+};
+
+// Formats a value the way ptree::put() does.
+template <class T_>
+std::string FormatXMLValue(const T_& v)
+{
+	typedef typename boost::property_tree::translator_between<std::string, T_>::type tTranslator;
+	boost::optional<std::string> s = tTranslator().put_value(v);
+	if (!s)
+		BOOST_PROPERTY_TREE_THROW(boost::property_tree::ptree_bad_data(std::string("conversion of type \"") + typeid(T_).name() + "\" to data failed", boost::any()));
+	return *s;
+}
+
+// Array property as one element, see cArrayText.
+template <class T_>
+void WriteXMLArray(cXMLWriter& writer, const char* name, const std::vector<T_>& v)
+{
+	std::string body;
+	writer.Begin(name);
+	if (writer.GetBase64Arrays())
+	{
+		writer.Attribute("encoding", "base64");
+		cArrayText::FormatBase64(v, body);
+	}
+	else
+	{
+		cArrayText::Format(v, body);
+	}
+	writer.Text(body);
+	writer.End(name);
+}
+
+// Static serializer writing straight to a cXMLWriter, no intermediate ptree. Values are
+// formatted by the same translators ptree::put() uses.
+class cStreamingXMLSerializer
+{
+public:
+	cStreamingXMLSerializer(cXMLWriter& writer) : Writer(writer) {}
+
+	void operator()(const char* name, const int& v) { Writer.Value(name, FormatXMLValue(v)); }
+	void operator()(const char* name, const uint& v) { Writer.Value(name, FormatXMLValue(v)); }
+	void operator()(const char* name, const cSharedString& v) { Writer.Value(name, v.Get()); }
+	void operator()(const char* name, const Vector3& v)
+	{
+		Writer.Begin(name);
+		Writer.Value("x", FormatXMLValue(v.X));
+		Writer.Value("y", FormatXMLValue(v.Y));
+		Writer.Value("z", FormatXMLValue(v.Z));
+		Writer.End(name);
+	}
+	template <class T_>
+	void operator()(const char* name, const std::vector<T_>& v) { WriteXMLArray(Writer, name, v); }
+	template <class C_>
+	void operator()(const char* name, const C_& collection)
+	{
+		Writer.Begin(name);
+		VisitProperties(collection, *this);
+		Writer.End(name);
+	}
+
+private:
+	cXMLWriter& Writer;
+};
+
+// Pair visitor writing the properties differing from those of a prototype, see
+// cObjectSystem::SetPrototype(). Of collections only the differing members are written;
+// the partial cXMLNodeDeserializer reads such elements back.
+class cStreamingXMLDiffSerializer
+{
+public:
+	cStreamingXMLDiffSerializer(cXMLWriter& writer) : Writer(writer), Saver(writer) {}
+
+	void operator()(const char* name, const int& v, const int& prototype) { Put(name, v, prototype); }
+	void operator()(const char* name, const uint& v, const uint& prototype) { Put(name, v, prototype); }
+	void operator()(const char* name, const cSharedString& v, const cSharedString& prototype) { Put(name, v, prototype); }
+	void operator()(const char* name, const Vector3& v, const Vector3& prototype) { Put(name, v, prototype); }
+	template <class T_>
+	void operator()(const char* name, const std::vector<T_>& v, const std::vector<T_>& prototype) { Put(name, v, prototype); }
+	template <class C_>
+	void operator()(const char* name, const C_& collection, const C_& prototype)
+	{
+		if (IsSame(name, collection, prototype))
+			return;
+		Writer.Begin(name);
+		VisitPropertyPairs(collection, prototype, *this);
+		Writer.End(name);
+	}
+
+private:
+	template <class T_>
+	static bool IsSame(const char* name, const T_& v, const T_& prototype)
+	{
+		cPropertyComparer comparer;
+		comparer(name, v, prototype);
+		return comparer.IsSame();
+	}
+
+	template <class T_>
+	void Put(const char* name, const T_& v, const T_& prototype)
+	{
+		if (!IsSame(name, v, prototype))
+			Saver(name, v);
+	}
+
+	cXMLWriter& Writer;
+	cStreamingXMLSerializer Saver;
+};
+
+// Runtime counterpart of cStreamingXMLSerializer writing single properties.
+class cStreamingPropertySerializer
+{
+public:
+	cStreamingPropertySerializer(cXMLWriter& writer) : Writer(writer), Static(writer) {}
+
+	template <cProperty::ePropertyType T_>
+	void Visit(cProperty& p);
+
+private:
+	cXMLWriter& Writer;
+	cStreamingXMLSerializer Static;
+};
+
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTInt>(cProperty& p)
+{
+	Static(p.GetName(), p.GetValue<int>());
+}
+
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTUInt>(cProperty& p)
+{
+	Static(p.GetName(), p.GetValue<uint>());
+}
+
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTString>(cProperty& p)
+{
+	Writer.Value(p.GetName(), p.GetValue<const char*>());
+}
+
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTVector3>(cProperty& p)
+{
+	Static(p.GetName(), p.GetValue<const Vector3&>());
+}
+
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTCollection>(cProperty& p)
+{
+	Writer.Begin(p.GetName());
+	for (cProperty member : p.GetValue<cPropertySet>())
+		member.Accept(*this);
+	Writer.End(p.GetName());
+}
+
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTIntArray>(cProperty& p) { Static(p.GetName(), p.GetValue<const tIntArray&>()); }
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTUIntArray>(cProperty& p) { Static(p.GetName(), p.GetValue<const tUIntArray&>()); }
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTFloatArray>(cProperty& p) { Static(p.GetName(), p.GetValue<const tFloatArray&>()); }
+template<> void cStreamingPropertySerializer::Visit<cProperty::ePTVector3Array>(cProperty& p) { Static(p.GetName(), p.GetValue<const tVector3Array&>()); }
+
+// Where the properties of a lazily loaded object come from.
+struct iPropertySource
+{
+	virtual ~iPropertySource() {}
+
+	// Loads the properties of the source's object 'index' into the object bound to 'properties'.
+	virtual void Load(const cPropertySet& properties, uint index) = 0;
+};
+
+// Storage keeping the properties of objects outside of them, e.g. cPropertyColumns.
+struct iPropertyStorage
+{
+	virtual ~iPropertyStorage() {}
+
+	virtual cPropertySet Bind(uint row) = 0;
+	// Where property i of row r lives, see cColumnLayout. Stays put while rows are added.
+	virtual const cColumnLayout& GetLayout() const = 0;
+};
+
+typedef boost::property_tree::detail::rapidxml::xml_node<char> tXMLNode;
+
+// An XML file parsed in place by rapidxml with the same flags and error reporting as read_xml().
+class cXMLDocument
+{
+public:
+	explicit cXMLDocument(const char* file)
+	{
+		Read(file, Text);
+		Parse(file);
+	}
+
+	// Parses a copy of 'text' Read() from 'file'.
+	cXMLDocument(const std::string& text, const char* file)
+		: Text(text.begin(), text.end())
+	{
+		Parse(file);
+	}
+
+	// The text of 'file' as the file constructor parses it.
+	template <class C_>
+	static void Read(const char* file, C_& text)
+	{
+		namespace xml = boost::property_tree::xml_parser;
+
+		std::ifstream stream(file);
+		if (!stream)
+			BOOST_PROPERTY_TREE_THROW(xml::xml_parser_error("cannot open file", file, 0));
+		// Block reads, a lot faster than going through the characters.
+		char buffer[65536];
+		text.clear();
+		while (stream.read(buffer, sizeof(buffer)) || stream.gcount())
+			text.insert(text.end(), buffer, buffer + stream.gcount());
+		if (stream.bad())
+			BOOST_PROPERTY_TREE_THROW(xml::xml_parser_error("read error", file, 0));
+	}
+
+	// Light scanning of top level text the way Parse() reads it, for finding elements without
+	// parsing them. Tags are told apart, not checked; what this takes for elements Parse()
+	// takes for the same or fails on. Start of the first element from 'p' on, past comments,
+	// declarations and such; 'end' if there is none, null if the text ends inside one of those.
+	static const char* FindElement(const char* p, const char* end)
+	{
+		for (;;)
+		{
+			p = static_cast<const char*>(memchr(p, '<', end - p));
+			if (!p)
+				return end;
+			if (p + 1 == end)
+				return nullptr;
+			if (p[1] == '?')
+				p = Skip(p + 2, end, "?>");
+			else if (p[1] == '!')
+				p = SkipMarkup(p, end);
+			else
+				return p;
+			if (!p)
+				return nullptr;
+		}
+	}
+
+	// End of the element starting at 'p', null if the text ends first.
+	static const char* SkipElement(const char* p, const char* end)
+	{
+		size_t depth = 0;
+		while (p)
+		{
+			p = static_cast<const char*>(memchr(p, '<', end - p));
+			if (!p || p + 1 == end)
+				return nullptr;
+			if (p[1] == '?')
+				p = Skip(p + 2, end, "?>");
+			else if (p[1] == '!')
+				p = SkipMarkup(p, end);
+			else if (p[1] == '/')
+			{
+				p = Skip(p + 2, end, ">");
+				if (p && --depth == 0)
+					return p;
+			}
+			else
+			{
+				// Attribute values may hold '>'.
+				for (++p; p != end && *p != '>'; ++p)
+				{
+					if (*p == '"' || *p == '\'')
+					{
+						p = static_cast<const char*>(memchr(p + 1, *p, end - p - 1));
+						if (!p)
+							return nullptr;
+					}
+				}
+				if (p == end)
+					return nullptr;
+				++p;
+				if (p[-2] != '/')
+					++depth;
+				else if (depth == 0)
+					return p;
+			}
+		}
+		return nullptr;
+	}
+
+	const tXMLNode& GetRoot() const { return Document; }
+
+	// Position in the text of a name or value of the DOM. Parsing in place keeps the names and
+	// values where they were, so this is also where they start in the original text.
+	size_t GetOffset(const char* p) const { return p - &Text.front(); }
+	size_t GetSize() const { return Text.size() - 1; }
+
+private:
+	// Past 'token' from 'p' on, null if there is none.
+	static const char* Skip(const char* p, const char* end, const char* token)
+	{
+		const char* tokenEnd = token + strlen(token);
+		p = std::search(p, end, token, tokenEnd);
+		return (p != end) ? p + (tokenEnd - token) : nullptr;
+	}
+
+	// Past the comment, CDATA section or DOCTYPE starting at 'p'.
+	static const char* SkipMarkup(const char* p, const char* end)
+	{
+		if (end - p >= 4 && memcmp(p, "<!--", 4) == 0)
+			return Skip(p + 4, end, "-->");
+		if (end - p >= 9 && memcmp(p, "<![CDATA[", 9) == 0)
+			return Skip(p + 9, end, "]]>");
+		for (p += 2; p && p != end; ++p)
+		{
+			if (*p == '>')
+				return p + 1;
+			if (*p == '[')
+			{
+				p = Skip(p + 1, end, "]");
+				if (!p)
+					return nullptr;
+				--p;
+			}
+		}
+		return nullptr;
+	}
+
+	void Parse(const char* file)
+	{
+		namespace xml = boost::property_tree::xml_parser;
+		namespace rapidxml = boost::property_tree::detail::rapidxml;
+
+		Text.push_back(0);
+		try
+		{
+			Document.parse<rapidxml::parse_comment_nodes>(&Text.front());
+		}
+		catch (rapidxml::parse_error& e)
+		{
+			long line = static_cast<long>(std::count(&Text.front(), e.where<char>(), '\n') + 1);
+			BOOST_PROPERTY_TREE_THROW(xml::xml_parser_error(e.what(), file, line));
+		}
+	}
+
+	std::vector<char> Text;
+	boost::property_tree::detail::rapidxml::xml_document<char> Document;
+};
+
+// Static deserializer reading straight from the rapidxml DOM. Lookups, conversions and
+// failures mirror ptree::get<T>(): first child with the name, text of its data nodes,
+// the same translators, and ptree_bad_path/ptree_bad_data exceptions. A partial
+// deserializer leaves properties without a node alone instead, as delta files only carry
+// what changed.
+class cXMLNodeDeserializer
+{
+public:
+	// A partial node may leave properties out, see cStreamingXMLDiffSerializer. Anything else
+	// it lacks or has bad data for throws, or under a lenient 'scope' is reported.
+	cXMLNodeDeserializer(const tXMLNode& node, bool partial = false, const cLoadScope& scope = cLoadScope()) : Node(node), Partial(partial), Scope(scope) {}
+
+	void operator()(const char* name, int& v) { Get(name, v); }
+	void operator()(const char* name, uint& v) { Get(name, v); }
+	void operator()(const char* name, cSharedString& v)
+	{
+		if (const tXMLNode* child = GetChild(name))
+		{
+			GetData(*child, Data);
+			v = Data;
+		}
+	}
+	void operator()(const char* name, Vector3& v)
+	{
+		if (const tXMLNode* child = GetChild(name))
+		{
+			cXMLNodeDeserializer loader(*child, Partial, cLoadScope(Scope, name));
+			loader.Get("x", v.X);
+			loader.Get("y", v.Y);
+			loader.Get("z", v.Z);
+		}
+	}
+	template <class T_>
+	void operator()(const char* name, std::vector<T_>& v)
+	{
+		if (const tXMLNode* child = GetChild(name))
+		{
+			const boost::property_tree::detail::rapidxml::xml_attribute<char>* encoding = child->first_attribute("encoding");
+			GetData(*child, Data);
+			ParseXMLArray(Data, encoding ? std::string(encoding->value(), encoding->value_size()) : std::string(), name, Scope, v);
+		}
+	}
+	template <class C_>
+	void operator()(const char* name, C_& collection)
+	{
+		if (const tXMLNode* child = GetChild(name))
+		{
+			cXMLNodeDeserializer loader(*child, Partial, cLoadScope(Scope, name));
+			VisitProperties(collection, loader);
+		}
+	}
+
+	// Reads child 'name' without throwing or reporting anything; false if it is missing or bad.
+	template <class T_>
+	bool Find(const char* name, T_& v)
+	{
+		const tXMLNode* child = Node.first_node(name);
+		if (!child)
+			return false;
+		GetData(*child, Data);
+		return Convert(v);
+	}
+
+private:
+	// Null for missing children of a partial node or reported ones.
+	const tXMLNode* GetChild(const char* name) const
+	{
+		const tXMLNode* child = Node.first_node(name);
+		if (!child && !Partial)
+		{
+			if (!Scope.IsLenient())
+				BOOST_PROPERTY_TREE_THROW(boost::property_tree::ptree_bad_path("No such node", tBoostPTree::path_type(name)));
+			Scope.Report(name, cLoadDiagnostics::eMissing);
+		}
+		return child;
+	}
+
+	static void GetData(const tXMLNode& node, std::string& data)
+	{
+		namespace rapidxml = boost::property_tree::detail::rapidxml;
+
+		data.clear();
+		for (const tXMLNode* child = node.first_node(); child; child = child->next_sibling())
+			if (child->type() == rapidxml::node_data || child->type() == rapidxml::node_cdata)
+				data.append(child->value(), child->value_size());
+	}
+
+	// Data into 'v', left alone if it does not convert.
+	template <class T_>
+	bool Convert(T_& v) const
+	{
+		typedef typename boost::property_tree::translator_between<std::string, T_>::type tTranslator;
+
+		boost::optional<T_> value = tTranslator().get_value(Data);
+		if (!value)
+			return false;
+		v = *value;
+		return true;
+	}
+
+	template <class T_>
+	void Get(const char* name, T_& v)
+	{
+		const tXMLNode* child = GetChild(name);
+		if (!child)
+			return;
+		GetData(*child, Data);
+		if (Convert(v))
+			return;
+		if (!Scope.IsLenient())
+			BOOST_PROPERTY_TREE_THROW(boost::property_tree::ptree_bad_data(std::string("conversion of data to type \"") + typeid(T_).name() + "\" failed", Data));
+		Scope.Report(name, cLoadDiagnostics::eBadData);
+	}
+
+	const tXMLNode& Node;
+	const bool Partial;
+	const cLoadScope Scope;
+	std::string Data;
+};
+
+struct iBaseObject
+{
+	virtual ~iBaseObject() {}
+
+	virtual cPropertySet GetProperties() = 0;
+	// cObjectSystem finds registered objects by the ID they are registered with, so the ID
+	// of a registered object stays.
+	virtual uint GetID() const = 0;
+	virtual void SetID(uint id) = 0;
+	virtual const char* GetObjectType() const = 0;
+
+	// The object this one is a variant of, see cObjectSystem::SetPrototype(). Null for none.
+	// Setting it keeps the variant counts of the prototypes, so unlink variants before
+	// destroying them while their prototype lives on.
+	virtual iBaseObject* GetPrototype() const = 0;
+	virtual void SetPrototype(iBaseObject* prototype) = 0;
+	// Objects linked to this one as their prototype; AddVariant() is for SetPrototype().
+	virtual uint GetVariantCount() const = 0;
+	virtual void AddVariant(bool linked) = 0;
+
+	// Moves the properties to row 'row' of 'storage'; GetProperties() binds there from now on.
+	virtual void SetPropertyStorage(iPropertyStorage& storage, uint row) = 0;
+	// Defers loading the properties to the first Hydrate().
+	virtual void SetPropertySource(iPropertySource& source, uint index) = 0;
+	// Makes sure lazily loaded properties are in place. GetProperties() does it implicitly.
+	virtual void Hydrate() = 0;
+
+	// While tracking is on, setters of GetProperties() flag the properties they change, and
+	// the first change of the object adds it to 'dirtied'. Members written directly need a
+	// MarkDirty(). Turning tracking on or off (null) clears the flags.
+	virtual void SetDirtyTracking(tDirtyList* dirtied) = 0;
+	virtual tDirtyMask GetDirty() const = 0;
+	virtual void MarkDirty(tDirtyMask mask) = 0;
+	virtual void ClearDirty() = 0;
+
+	// While set, setters of GetProperties() queue their changes to 'queue', see cChangeQueue.
+	// Null stops.
+	virtual void SetChangeQueue(cChangeQueue* queue) = 0;
+	virtual bool HasQueuedChanges() const = 0;
+};
+
+class cBaseObject : public iBaseObject
+{
+public:
+	static const cPropertySchema SSchema;
+
+	template <class V_>
+	static void DescribeProperties(V_& v)
+	{
+		v("ID", &cBaseObject::ID);
+	}
+
+	cBaseObject(uint id, const char* type)
+		: ID(id)
+		, ObjectType(type)
+		, Prototype(nullptr)
+		, Storage(nullptr)
+		, StorageLayout(nullptr)
+		, StorageRow(0)
+		, Source(nullptr)
+		, SourceIndex(0)
+	{
+	}
+
+	// iBaseProperties:
+	virtual cPropertySet GetProperties() override
+	{
+		Hydrate();
+		cPropertySet properties = Bind();
+		properties.TrackChanges(&Changes);
+		return properties;
+	}
+	virtual uint GetID() const
+	{
+		return Storage ? *GetStoredID() : ID;
+	}
+	virtual void SetID(uint id) override
+	{
+		if (Storage)
+			*GetStoredID() = id;
+		else
+			ID = id;
+	}
+	virtual const char* GetObjectType() const { return ObjectType.c_str(); }
+	virtual iBaseObject* GetPrototype() const override { return Prototype; }
+	virtual void SetPrototype(iBaseObject* prototype) override
+	{
+		if (Prototype)
+			Prototype->AddVariant(false);
+		Prototype = prototype;
+		if (Prototype)
+			Prototype->AddVariant(true);
+	}
+	virtual uint GetVariantCount() const override { return Variants.Count; }
+	virtual void AddVariant(bool linked) override
+	{
+		if (linked)
+			++Variants.Count;
+		else if (Variants.Count)
+			--Variants.Count;
+	}
+	virtual void SetPropertyStorage(iPropertyStorage& storage, uint row) override
+	{
+		Storage = &storage;
+		StorageLayout = &storage.GetLayout();
+		StorageRow = row;
+	}
+	virtual void SetPropertySource(iPropertySource& source, uint index) override
+	{
+		Source = &source;
+		SourceIndex = index;
+	}
+	virtual void Hydrate() override
+	{
+		if (iPropertySource* source = Source)
+		{
+			Source = nullptr;
+			source->Load(Bind(), SourceIndex);
+		}
+	}
+	virtual void SetDirtyTracking(tDirtyList* dirtied) override
+	{
+		Changes.SetDirtied(dirtied);
+		Changes.Object = this;
+	}
+	virtual tDirtyMask GetDirty() const override { return Changes.Dirty; }
+	virtual void MarkDirty(tDirtyMask mask) override { Changes.MarkDirty(mask); }
+	virtual void ClearDirty() override { Changes.ClearDirty(); }
+	virtual void SetChangeQueue(cChangeQueue* queue) override
+	{
+		Changes.Queue = queue;
+		Changes.Queued = 0;
+		Changes.Object = this;
+	}
+	virtual bool HasQueuedChanges() const override { return Changes.Queued != 0; }
+	// iBaseProperties.
+
+	uint GetStorageRow() const { return StorageRow; }
+	// Null while the object keeps its own properties, see GetStorageLayout().
+	const cColumnLayout* GetStorageLayout(uint& row) const
+	{
+		row = StorageRow;
+		return StorageLayout;
+	}
+
+protected:
+	// The properties of the most derived class. Every class with its own schema overrides it.
+	virtual cPropertySet BindProperties() { return cPropertySet(this); }
+
+	uint ID;
+	std::string ObjectType;
+
+private:
+	cPropertySet Bind() { return Storage ? Storage->Bind(StorageRow) : BindProperties(); }
+
+	// With external storage the live ID is there: classes describe their base first, so it
+	// is the first column, see cColumnFactory.
+	uint* GetStoredID() const { return reinterpret_cast<uint*>(StorageLayout->Columns[0]) + StorageRow; }
+
+	// Copies of a prototype have no variants of their own.
+	struct cVariantCount
+	{
+		cVariantCount() : Count(0) {}
+		cVariantCount(const cVariantCount&) : Count(0) {}
+		cVariantCount& operator=(const cVariantCount&) { return *this; }
+
+		uint Count;
+	};
+
+	iBaseObject* Prototype;
+	cVariantCount Variants;
+	iPropertyStorage* Storage;
+	const cColumnLayout* StorageLayout;
+	uint StorageRow;
+	iPropertySource* Source;
+	uint SourceIndex;
+	cChangeFlags Changes;
+};
+
+const cPropertySchema cBaseObject::SSchema = cPropertySchema::Build<cBaseObject>();
+
+typedef uint tTypeId;
+
+// Process wide table interning object type names to dense integer ids. Locked, as new
+// types may be interned while other threads look names up, e.g. the journal compactor.
+class cTypeNames
+{
+public:
+	static const tTypeId SInvalid = ~0u;
+
+	static tTypeId Intern(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(Mutex());
+		auto it = Ids().insert(tIds::value_type(name, (tTypeId)Names().size()));
+		if (it.second)
+			Names().push_back(&it.first->first);
+		return it.first->second;
+	}
+
+	static tTypeId Find(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(Mutex());
+		auto it = Ids().find(name);
+		if (it == Ids().end())
+			return SInvalid;
+		return it->second;
+	}
+
+	// Names stay where they are once interned.
+	static const std::string& GetName(tTypeId id)
+	{
+		std::lock_guard<std::mutex> lock(Mutex());
+		return *Names()[id];
+	}
+
+	// Id of C_::SObjectType, interned on first use and cached per type.
+	template <class C_>
+	static tTypeId Of()
+	{
+		static const tTypeId id = Intern(C_::SObjectType);
+		return id;
+	}
+
+private:
+	typedef std::unordered_map<std::string, tTypeId> tIds;
+
+	static tIds& Ids() { static tIds ids; return ids; }
+	static std::vector<const std::string*>& Names() { static std::vector<const std::string*> names; return names; }
+	static std::mutex& Mutex() { static std::mutex mutex; return mutex; }
+};
+
+// Dense array of values addressed through generational handles. Insert, Erase and Find
+// are O(1); values stay contiguous for iteration, Erase moves the last value into the hole.
+// A handle whose slot has been erased (or reused) no longer resolves.
+template <class T_>
+class cSlotMap
+{
+public:
+	struct cHandle
+	{
+		cHandle() : Index(0), Generation(0) {}
+		cHandle(uint index, uint generation) : Index(index), Generation(generation) {}
+
+		bool IsNull() const { return Generation == 0; }
+		bool operator==(const cHandle& other) const { return Index == other.Index && Generation == other.Generation; }
+		bool operator!=(const cHandle& other) const { return !(*this == other); }
+
+		uint Index;
+		uint Generation;	// 0 is never handed out.
+	};
+
+	typedef typename std::vector<T_>::iterator iterator;
+	typedef typename std::vector<T_>::const_iterator const_iterator;
+
+public:
+	cSlotMap() : FreeSlot(SNone) {}
+
+	cHandle Insert(const T_& value)
+	{
+		uint index;
+		if (FreeSlot != SNone)
+		{
+			index = FreeSlot;
+			FreeSlot = Slots[index].Dense;
+		}
+		else
+		{
+			index = (uint)Slots.size();
+			Slots.push_back(cSlot(1));
+		}
+
+		cSlot& slot = Slots[index];
+		slot.Dense = (uint)Values.size();
+		Values.push_back(value);
+		DenseToSlot.push_back(index);
+		return cHandle(index, slot.Generation);
+	}
+
+	bool Erase(cHandle h)
+	{
+		if (!IsValid(h))
+			return false;
+
+		cSlot& slot = Slots[h.Index];
+		const uint last = (uint)Values.size() - 1;
+		if (slot.Dense != last)
+		{
+			Values[slot.Dense] = std::move(Values[last]);
+			DenseToSlot[slot.Dense] = DenseToSlot[last];
+			Slots[DenseToSlot[last]].Dense = slot.Dense;
+		}
+		Values.pop_back();
+		DenseToSlot.pop_back();
+
+		if (++slot.Generation == 0)
+			slot.Generation = 1;
+		slot.Dense = FreeSlot;
+		FreeSlot = h.Index;
+		return true;
+	}
+
+	T_* Find(cHandle h) { return IsValid(h) ? &Values[Slots[h.Index].Dense] : nullptr; }
+	const T_* Find(cHandle h) const { return IsValid(h) ? &Values[Slots[h.Index].Dense] : nullptr; }
+
+	bool IsValid(cHandle h) const { return h.Index < Slots.size() && Slots[h.Index].Generation == h.Generation; }
+
+	// Handle of the value at dense position i.
+	cHandle GetHandle(size_t i) const { const uint index = DenseToSlot[i]; return cHandle(index, Slots[index].Generation); }
+
+	void Reserve(size_t count) { Values.reserve(count); DenseToSlot.reserve(count); Slots.reserve(count); }
+	size_t Size() const { return Values.size(); }
+
+	iterator begin() { return Values.begin(); }
+	iterator end() { return Values.end(); }
+	const_iterator begin() const { return Values.begin(); }
+	const_iterator end() const { return Values.end(); }
+
+private:
+	static const uint SNone = ~0u;
+
+	struct cSlot
+	{
+		explicit cSlot(uint generation) : Dense(SNone), Generation(generation) {}
+
+		uint Dense;			// Index into Values, or the next free slot while free.
+		uint Generation;
+	};
+
+	std::vector<T_> Values;
+	std::vector<uint> DenseToSlot;
+	std::vector<cSlot> Slots;
+	uint FreeSlot;
+};
+
+// Per-type object storage. Objects are carved out of large contiguous chunks and returned
+// to an intrusive free list, so the pool only hits the heap once per chunk.
+template <class C_>
+class cObjectPool
+{
+public:
+	cObjectPool() : Cursor(nullptr), CursorEnd(nullptr), FreeList(nullptr) {}
+
+	void* Allocate()
+	{
+		if (FreeList)
+		{
+			cFreeNode* node = FreeList;
+			FreeList = node->Next;
+			return node;
+		}
+		if (Cursor == CursorEnd)
+			AddChunk(SChunkSize);
+		return Cursor++;
+	}
+
+	// The object must already be destroyed.
+	void Free(void* p)
+	{
+		cFreeNode* node = static_cast<cFreeNode*>(p);
+		node->Next = FreeList;
+		FreeList = node;
+	}
+
+	// Makes sure the next 'count' allocations are served without touching the heap again.
+	void Reserve(size_t count)
+	{
+		size_t available = CursorEnd - Cursor;
+		for (cFreeNode* node = FreeList; node && available < count; node = node->Next)
+			++available;
+		if (available < count)
+		{
+			// Whatever is left in the current chunk goes to the free list first.
+			while (Cursor != CursorEnd)
+				Free(Cursor++);
+			AddChunk(count - available);
+		}
+	}
+
+private:
+	typedef typename std::aligned_storage<sizeof(C_), std::alignment_of<C_>::value>::type tStorage;
+
+	struct cFreeNode
+	{
+		cFreeNode* Next;
+	};
+
+	static_assert(sizeof(tStorage) >= sizeof(cFreeNode), "Pooled type is too small for the free list");
+
+	static const size_t SChunkSize = 256;
+
+	void AddChunk(size_t count)
+	{
+		Chunks.push_back(std::unique_ptr<tStorage[]>(new tStorage[count]));
+		Cursor = Chunks.back().get();
+		CursorEnd = Cursor + count;
+	}
+
+	std::vector<std::unique_ptr<tStorage[]>> Chunks;
+	tStorage* Cursor;
+	tStorage* CursorEnd;
+	cFreeNode* FreeList;
+};
+
+// Structure-of-arrays storage for the properties of C_: one contiguous column per property
+// declared by C_::DescribeProperties(), so a sweep over one property streams through memory.
+// Rows are recycled through a free list. Growing the columns moves them, which invalidates
+// cPropertySets bound before.
+template <class C_>
+class cPropertyColumns : public iPropertyStorage
+{
+public:
+	cPropertyColumns() : Rows(0)
+	{
+		cBuilder builder(Columns);
+		C_::DescribeProperties(builder);
+		Layout.Columns.resize(Columns.size());
+		Layout.Strides.resize(Columns.size());
+		for (size_t i = 0; i < Columns.size(); ++i)
+			Layout.Strides[i] = Columns[i]->GetStride();
+		UpdateLayout();
+	}
+
+	// New row taking over the property values of 'object'; its members are left at their
+	// defaults.
+	uint Allocate(C_& object)
+	{
+		uint row;
+		if (!FreeRows.empty())
+		{
+			row = FreeRows.back();
+			FreeRows.pop_back();
+		}
+		else
+		{
+			row = Rows++;
+			for (auto& column : Columns)
+				column->Resize(Rows);
+			UpdateLayout();
+		}
+		for (auto& column : Columns)
+			column->Assign(row, object);
+		return row;
+	}
+
+	void Free(uint row)
+	{
+		for (auto& column : Columns)
+			column->Reset(row);
+		FreeRows.push_back(row);
+	}
+
+	void Reserve(size_t count)
+	{
+		const size_t rows = Rows + ((count > FreeRows.size()) ? count - FreeRows.size() : 0);
+		for (auto& column : Columns)
+			column->Reserve(rows);
+		UpdateLayout();
+	}
+
+	// Rows ever allocated; freed rows hold default values until reused.
+	size_t GetRowCount() const { return Rows; }
+
+	// The column of a property, for sweeps over all rows. Null unless there is a T_ property
+	// by that name.
+	template <class T_>
+	T_* GetColumn(const char* property) const
+	{
+		for (size_t i = 0; i < C_::SSchema.GetSize(); ++i)
+			if (strcmp(C_::SSchema[i].Name, property) == 0)
+				return (C_::SSchema[i].Type == cPropertyTypeOf<T_>::SType) ? reinterpret_cast<T_*>(Layout.Columns[i]) : nullptr;
+		return nullptr;
+	}
+
+	// Statically dispatched walk like VisitProperties(), over the values of a row.
+	template <class V_>
+	void Visit(uint row, V_& visitor) const
+	{
+		cVisit<V_> visit(Columns, row, visitor);
+		C_::DescribeProperties(visit);
+	}
+
+	// Visit() over two rows at once, like VisitPropertyPairs().
+	template <class V_>
+	void Visit(uint row, uint other, V_& visitor) const
+	{
+		cPairVisit<V_> visit(Columns, row, other, visitor);
+		C_::DescribeProperties(visit);
+	}
+
+	// iPropertyStorage:
+	virtual cPropertySet Bind(uint row) override { return cPropertySet(C_::SSchema, Layout, row); }
+	virtual const cColumnLayout& GetLayout() const override { return Layout; }
+	// iPropertyStorage.
+
+private:
+	struct iColumn
+	{
+		virtual ~iColumn() {}
+
+		virtual size_t GetStride() const = 0;
+		virtual char* GetData() = 0;
+		virtual void Reserve(size_t rows) = 0;
+		virtual void Resize(size_t rows) = 0;
+		virtual void Assign(uint row, C_& object) = 0;
+		virtual void Reset(uint row) = 0;
+	};
+
+	template <class T_, class B_>
+	class cColumn : public iColumn
+	{
+	public:
+		explicit cColumn(T_ B_::* member) : Member(member) {}
+
+		// iColumn:
+		virtual size_t GetStride() const override { return sizeof(T_); }
+		virtual char* GetData() override { return reinterpret_cast<char*>(Values.data()); }
+		virtual void Reserve(size_t rows) override { Values.reserve(rows); }
+		virtual void Resize(size_t rows) override { Values.resize(rows); }
+		virtual void Assign(uint row, C_& object) override
+		{
+			Values[row] = std::move(object.*Member);
+			object.*Member = T_();
+		}
+		virtual void Reset(uint row) override { Values[row] = T_(); }
+		// iColumn.
+
+		std::vector<T_> Values;
+
+	private:
+		T_ B_::* Member;
+	};
+
+	typedef std::vector<std::unique_ptr<iColumn>> tColumns;
+
+	class cBuilder
+	{
+	public:
+		cBuilder(tColumns& columns) : Columns(columns) {}
+
+		template <class T_, class B_>
+		void operator()(const char* name, T_ B_::* m) { Columns.push_back(std::unique_ptr<iColumn>(new cColumn<T_, B_>(m))); }
+
+	private:
+		tColumns& Columns;
+	};
+
+	template <class V_>
+	class cVisit
+	{
+	public:
+		cVisit(const tColumns& columns, uint row, V_& visitor) : Columns(columns), Row(row), Visitor(visitor), Index(0) {}
+
+		template <class T_, class B_>
+		void operator()(const char* name, T_ B_::* m) { Visitor(name, static_cast<cColumn<T_, B_>&>(*Columns[Index++]).Values[Row]); }
+
+	private:
+		const tColumns& Columns;
+		const uint Row;
+		V_& Visitor;
+		size_t Index;
+	};
+
+	template <class V_>
+	class cPairVisit
+	{
+	public:
+		cPairVisit(const tColumns& columns, uint row, uint other, V_& visitor) : Columns(columns), Row(row), Other(other), Visitor(visitor), Index(0) {}
+
+		template <class T_, class B_>
+		void operator()(const char* name, T_ B_::* m)
+		{
+			std::vector<T_>& values = static_cast<cColumn<T_, B_>&>(*Columns[Index++]).Values;
+			Visitor(name, values[Row], values[Other]);
+		}
+
+	private:
+		const tColumns& Columns;
+		const uint Row;
+		const uint Other;
+		V_& Visitor;
+		size_t Index;
+	};
+
+	void UpdateLayout()
+	{
+		for (size_t i = 0; i < Columns.size(); ++i)
+			Layout.Columns[i] = Columns[i]->GetData();
+	}
+
+	tColumns Columns;
+	cColumnLayout Layout;
+	uint Rows;
+	std::vector<uint> FreeRows;
+};
+
+// Reference implementation of the cVector3Kernels batches, also running their remainders.
+// V_ is Vector3 or Vector3A.
+struct cScalarVector3Kernels
+{
+	template <class V_>
+	static void Translate(V_* v, size_t count, const Vector3& offset)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			v[i].X += offset.X;
+			v[i].Y += offset.Y;
+			v[i].Z += offset.Z;
+		}
+	}
+
+	template <class V_>
+	static void Scale(V_* v, size_t count, const Vector3& scale)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			v[i].X *= scale.X;
+			v[i].Y *= scale.Y;
+			v[i].Z *= scale.Z;
+		}
+	}
+
+	template <class V_>
+	static void GetDistances(const V_* v, size_t count, const Vector3& point, float* out)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			const float dx = v[i].X - point.X;
+			const float dy = v[i].Y - point.Y;
+			const float dz = v[i].Z - point.Z;
+			out[i] = sqrtf(dx * dx + dy * dy + dz * dz);
+		}
+	}
+
+	template <class V_>
+	static size_t TestAABB(const V_* v, size_t count, const Vector3& min, const Vector3& max, unsigned char* inside)
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const bool in = min.X <= v[i].X && v[i].X <= max.X && min.Y <= v[i].Y && v[i].Y <= max.Y && min.Z <= v[i].Z && v[i].Z <= max.Z;
+			if (inside)
+				inside[i] = in;
+			n += in;
+		}
+		return n;
+	}
+
+	// Widens [min, max] to cover the points.
+	template <class V_>
+	static void AddBounds(const V_* v, size_t count, Vector3& min, Vector3& max)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			min.X = (v[i].X < min.X) ? v[i].X : min.X;
+			min.Y = (v[i].Y < min.Y) ? v[i].Y : min.Y;
+			min.Z = (v[i].Z < min.Z) ? v[i].Z : min.Z;
+			max.X = (v[i].X > max.X) ? v[i].X : max.X;
+			max.Y = (v[i].Y > max.Y) ? v[i].Y : max.Y;
+			max.Z = (v[i].Z > max.Z) ? v[i].Z : max.Z;
+		}
+	}
+
+	template <class V_>
+	static bool GetBounds(const V_* v, size_t count, Vector3& min, Vector3& max)
+	{
+		if (count == 0)
+			return false;
+		min = max = Vector3(v[0].X, v[0].Y, v[0].Z);
+		AddBounds(v + 1, count - 1, min, max);
+		return true;
+	}
+};
+
+#ifdef PTREE_SSE
+// Register widths cSimdVector3Kernels is written against. Load() splits points into X, Y
+// and Z lanes; no alignment is assumed.
+struct cSimd4
+{
+	typedef __m128 tReg;
+	static const size_t SWidth = 4;
+
+	static tReg Set(float v) { return _mm_set1_ps(v); }
+	static tReg LoadFloats(const float* p) { return _mm_loadu_ps(p); }
+	static void Store(float* p, tReg v) { _mm_storeu_ps(p, v); }
+	static tReg Add(tReg a, tReg b) { return _mm_add_ps(a, b); }
+	static tReg Sub(tReg a, tReg b) { return _mm_sub_ps(a, b); }
+	static tReg Mul(tReg a, tReg b) { return _mm_mul_ps(a, b); }
+	static tReg Sqrt(tReg a) { return _mm_sqrt_ps(a); }
+	static tReg Min(tReg a, tReg b) { return _mm_min_ps(a, b); }
+	static tReg Max(tReg a, tReg b) { return _mm_max_ps(a, b); }
+	static tReg And(tReg a, tReg b) { return _mm_and_ps(a, b); }
+	static tReg LessEqual(tReg a, tReg b) { return _mm_cmple_ps(a, b); }
+	static int MoveMask(tReg a) { return _mm_movemask_ps(a); }
+
+	// x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+	static void Load(const Vector3* p, tReg& x, tReg& y, tReg& z)
+	{
+		const float* f = &p->X;
+		const tReg a = _mm_loadu_ps(f), b = _mm_loadu_ps(f + 4), c = _mm_loadu_ps(f + 8);
+		x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+		y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+		z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0));
+	}
+
+	static void Load(const Vector3A* p, tReg& x, tReg& y, tReg& z)
+	{
+		tReg a = _mm_loadu_ps(&p[0].X), b = _mm_loadu_ps(&p[1].X), c = _mm_loadu_ps(&p[2].X), d = _mm_loadu_ps(&p[3].X);
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		x = a;
+		y = b;
+		z = c;
+	}
+};
+
+#ifdef PTREE_AVX
+struct cSimd8
+{
+	typedef __m256 tReg;
+	static const size_t SWidth = 8;
+
+	static tReg Set(float v) { return _mm256_set1_ps(v); }
+	static tReg LoadFloats(const float* p) { return _mm256_loadu_ps(p); }
+	static void Store(float* p, tReg v) { _mm256_storeu_ps(p, v); }
+	static tReg Add(tReg a, tReg b) { return _mm256_add_ps(a, b); }
+	static tReg Sub(tReg a, tReg b) { return _mm256_sub_ps(a, b); }
+	static tReg Mul(tReg a, tReg b) { return _mm256_mul_ps(a, b); }
+	static tReg Sqrt(tReg a) { return _mm256_sqrt_ps(a); }
+	static tReg Min(tReg a, tReg b) { return _mm256_min_ps(a, b); }
+	static tReg Max(tReg a, tReg b) { return _mm256_max_ps(a, b); }
+	static tReg And(tReg a, tReg b) { return _mm256_and_ps(a, b); }
+	static tReg LessEqual(tReg a, tReg b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static int MoveMask(tReg a) { return _mm256_movemask_ps(a); }
+
+	// Two SSE loads, one per 128 bit half.
+	template <class V_>
+	static void Load(const V_* p, tReg& x, tReg& y, tReg& z)
+	{
+		__m128 x0, y0, z0, x1, y1, z1;
+		cSimd4::Load(p, x0, y0, z0);
+		cSimd4::Load(p + 4, x1, y1, z1);
+		x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+		y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+		z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+	}
+};
+#endif
+
+// cVector3Kernels running S_ wide. Remainders shorter than a register go through the
+// scalar loops.
+template <class S_>
+class cSimdVector3Kernels
+{
+public:
+	static void Translate(Vector3* v, size_t count, const Vector3& offset) { Apply<cAdd>(v, count, offset); }
+	static void Translate(Vector3A* v, size_t count, const Vector3& offset) { Apply<cAdd>(v, count, offset); }
+	static void Scale(Vector3* v, size_t count, const Vector3& scale) { Apply<cMul>(v, count, scale); }
+	static void Scale(Vector3A* v, size_t count, const Vector3& scale) { Apply<cMul>(v, count, scale); }
+
+	// out[i] = |v[i] - point|.
+	template <class V_>
+	static void GetDistances(const V_* v, size_t count, const Vector3& point, float* out)
+	{
+		size_t i = 0;
+		typedef S_ S;
+		const typename S::tReg px = S::Set(point.X), py = S::Set(point.Y), pz = S::Set(point.Z);
+		for (; i + S::SWidth <= count; i += S::SWidth)
+		{
+			typename S::tReg x, y, z;
+			S::Load(v + i, x, y, z);
+			const typename S::tReg dx = S::Sub(x, px), dy = S::Sub(y, py), dz = S::Sub(z, pz);
+			S::Store(out + i, S::Sqrt(S::Add(S::Add(S::Mul(dx, dx), S::Mul(dy, dy)), S::Mul(dz, dz))));
+		}
+		cScalarVector3Kernels::GetDistances(v + i, count - i, point, out + i);
+	}
+
+	// Counts the points inside the box [min, max], bounds included. 'inside', if given,
+	// receives 1 or 0 per point.
+	template <class V_>
+	static size_t TestAABB(const V_* v, size_t count, const Vector3& min, const Vector3& max, unsigned char* inside)
+	{
+		size_t i = 0;
+		size_t n = 0;
+		typedef S_ S;
+		const typename S::tReg minX = S::Set(min.X), minY = S::Set(min.Y), minZ = S::Set(min.Z);
+		const typename S::tReg maxX = S::Set(max.X), maxY = S::Set(max.Y), maxZ = S::Set(max.Z);
+		for (; i + S::SWidth <= count; i += S::SWidth)
+		{
+			typename S::tReg x, y, z;
+			S::Load(v + i, x, y, z);
+			const typename S::tReg in = S::And(S::And(S::And(S::LessEqual(minX, x), S::LessEqual(x, maxX)), S::And(S::LessEqual(minY, y), S::LessEqual(y, maxY))),
+				S::And(S::LessEqual(minZ, z), S::LessEqual(z, maxZ)));
+			const int bits = S::MoveMask(in);
+			for (size_t k = 0; k < S::SWidth; ++k)
+			{
+				const unsigned char bit = (bits >> k) & 1;
+				if (inside)
+					inside[i + k] = bit;
+				n += bit;
+			}
+		}
+		return n + cScalarVector3Kernels::TestAABB(v + i, count - i, min, max, inside ? inside + i : nullptr);
+	}
+
+	// Bounding box of the points; false and nothing written for none.
+	template <class V_>
+	static bool GetBounds(const V_* v, size_t count, Vector3& min, Vector3& max)
+	{
+		typedef S_ S;
+		if (count >= S::SWidth)
+		{
+			typename S::tReg minX, minY, minZ;
+			S::Load(v, minX, minY, minZ);
+			typename S::tReg maxX = minX, maxY = minY, maxZ = minZ;
+			size_t i = S::SWidth;
+			for (; i + S::SWidth <= count; i += S::SWidth)
+			{
+				typename S::tReg x, y, z;
+				S::Load(v + i, x, y, z);
+				minX = S::Min(x, minX); minY = S::Min(y, minY); minZ = S::Min(z, minZ);
+				maxX = S::Max(x, maxX); maxY = S::Max(y, maxY); maxZ = S::Max(z, maxZ);
+			}
+
+			// Reduce the lanes, then the remainder.
+			float lanes[6][S::SWidth];
+			S::Store(lanes[0], minX); S::Store(lanes[1], minY); S::Store(lanes[2], minZ);
+			S::Store(lanes[3], maxX); S::Store(lanes[4], maxY); S::Store(lanes[5], maxZ);
+			min = Vector3(lanes[0][0], lanes[1][0], lanes[2][0]);
+			max = Vector3(lanes[3][0], lanes[4][0], lanes[5][0]);
+			for (size_t k = 1; k < S::SWidth; ++k)
+			{
+				const Vector3 lo(lanes[0][k], lanes[1][k], lanes[2][k]);
+				const Vector3 hi(lanes[3][k], lanes[4][k], lanes[5][k]);
+				cScalarVector3Kernels::AddBounds(&lo, 1, min, max);
+				cScalarVector3Kernels::AddBounds(&hi, 1, min, max);
+			}
+			cScalarVector3Kernels::AddBounds(v + i, count - i, min, max);
+			return true;
+		}
+		return cScalarVector3Kernels::GetBounds(v, count, min, max);
+	}
+
+private:
+	static_assert(sizeof(Vector3) == 3 * sizeof(float), "Vector3 is expected to be packed");
+	static_assert(sizeof(Vector3A) == 4 * sizeof(float), "Vector3A is expected to be 4 floats");
+
+	struct cAdd
+	{
+		static void Scalar(Vector3* v, size_t count, const Vector3& w) { cScalarVector3Kernels::Translate(v, count, w); }
+		static void Scalar(Vector3A* v, size_t count, const Vector3& w) { cScalarVector3Kernels::Translate(v, count, w); }
+		template <class W_>
+		static typename W_::tReg Wide(typename W_::tReg a, typename W_::tReg b) { return W_::Add(a, b); }
+	};
+
+	struct cMul
+	{
+		static void Scalar(Vector3* v, size_t count, const Vector3& w) { cScalarVector3Kernels::Scale(v, count, w); }
+		static void Scalar(Vector3A* v, size_t count, const Vector3& w) { cScalarVector3Kernels::Scale(v, count, w); }
+		template <class W_>
+		static typename W_::tReg Wide(typename W_::tReg a, typename W_::tReg b) { return W_::Mul(a, b); }
+	};
+
+	// Component-wise O_ of every point with 'w'. The points are treated as a flat float array
+	// against a register pattern repeating 'w' (and 0 for the padding of Vector3A), so there
+	// is no shuffling: three registers cover SWidth Vector3s, one covers SWidth / 4 Vector3As.
+	template <class O_, class V_>
+	static void Apply(V_* v, size_t count, const Vector3& w)
+	{
+		size_t i = 0;
+		typedef S_ S;
+		const size_t floats = sizeof(V_) / sizeof(float);
+		const size_t registers = (floats == 3) ? 3 : 1;
+		const size_t points = registers * S::SWidth / floats;
+
+		const float values[4] = { w.X, w.Y, w.Z, 0.f };
+		float pattern[3 * S::SWidth];
+		for (size_t k = 0; k < registers * S::SWidth; ++k)
+			pattern[k] = values[k % floats];
+		typename S::tReg p[3];
+		for (size_t r = 0; r < registers; ++r)
+			p[r] = S::LoadFloats(pattern + r * S::SWidth);
+
+		float* f = reinterpret_cast<float*>(v);
+		for (; i + points <= count; i += points, f += registers * S::SWidth)
+			for (size_t r = 0; r < registers; ++r)
+				S::Store(f + r * S::SWidth, O_::template Wide<S>(S::LoadFloats(f + r * S::SWidth), p[r]));
+		O_::Scalar(v + i, count - i, w);
+	}
+};
+#endif
+
+// Batch operations over contiguous points, typically a Position column of cPropertyColumns
+// (see GetColumn()) or an array of Vector3A. Results match cScalarVector3Kernels exactly.
+// Writing through a raw column bypasses dirty tracking, so mark the objects if it is on.
+#if defined(PTREE_AVX)
+class cVector3Kernels : public cSimdVector3Kernels<cSimd8> {};
+#elif defined(PTREE_SSE)
+class cVector3Kernels : public cSimdVector3Kernels<cSimd4> {};
+#else
+class cVector3Kernels : public cScalarVector3Kernels {};
+#endif
+
+// Fixed set of threads for data parallel work. Run() hands out task(0)..task(count - 1) in
+// order, works along on the calling thread and returns once all of them are done.
+class cWorkerPool
+{
+public:
+	typedef std::function<void(size_t)> tTask;
+
+	// 'threads' counts the calling thread; 0 means one per hardware thread.
+	explicit cWorkerPool(uint threads = 0)
+		: Count(0)
+		, Next(0)
+		, Busy(0)
+		, Generation(0)
+		, Quit(false)
+		, FailedIndex(0)
+	{
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		for (uint i = 1; i < threads; ++i)
+			Workers.push_back(std::thread(&cWorkerPool::WorkerMain, this));
+	}
+
+	~cWorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Quit = true;
+		}
+		Wake.notify_all();
+		for (auto& worker : Workers)
+			worker.join();
+	}
+
+	uint GetThreadCount() const { return (uint)Workers.size() + 1; }
+
+	// Once a task throws no further tasks are started; the exception of the lowest failing
+	// index is rethrown, as a serial loop would.
+	void Run(size_t count, const tTask& task)
+	{
+		if (count == 0)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Task = task;
+			Count = count;
+			Next = 0;
+			Busy = (uint)Workers.size();
+			++Generation;
+		}
+		Wake.notify_all();
+		Work();
+
+		std::exception_ptr failure;
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			Done.wait(lock, [this] { return Busy == 0; });
+			Task = nullptr;
+			std::swap(failure, Failure);
+		}
+		if (failure)
+			std::rethrow_exception(failure);
+	}
+
+private:
+	cWorkerPool(const cWorkerPool&);
+	cWorkerPool& operator=(const cWorkerPool&);
+
+	void WorkerMain()
+	{
+		uint64 seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(Mutex);
+				Wake.wait(lock, [&] { return Quit || Generation != seen; });
+				if (Quit)
+					return;
+				seen = Generation;
+			}
+			Work();
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				if (--Busy == 0)
+					Done.notify_one();
+			}
+		}
+	}
+
+	void Work()
+	{
+		for (size_t i = Next++; i < Count; i = Next++)
+		{
+			try
+			{
+				Task(i);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				if (!Failure || i < FailedIndex)
+				{
+					Failure = std::current_exception();
+					FailedIndex = i;
+				}
+				Next = Count;
+			}
+		}
+	}
+
+	std::vector<std::thread> Workers;
+	std::mutex Mutex;
+	std::condition_variable Wake;
+	std::condition_variable Done;
+
+	// Current Run(), published under Mutex.
+	tTask Task;
+	size_t Count;
+	std::atomic<size_t> Next;
+	uint Busy;
+	uint64 Generation;
+	bool Quit;
+	std::exception_ptr Failure;
+	size_t FailedIndex;
+};
+
+// Buffered binary file output.
+class cBinaryWriter
+{
+public:
+	// Collects the output in memory, see GetBuffer().
+	cBinaryWriter()
+		: Handle(nullptr)
+		, Written(0)
+	{
+	}
+
+	explicit cBinaryWriter(const char* file)
+		: File(file)
+		, Handle(fopen(file, "wb"))
+		, Written(0)
+	{
+		if (!Handle)
+			BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("cannot open file", File, 0));
+		Buffer.reserve(SBufferSize + SBufferSize / 4);
+	}
+
+	~cBinaryWriter()
+	{
+		if (Handle)
+			fclose(Handle);
+	}
+
+	void Put(const void* data, size_t size)
+	{
+		Buffer.append(static_cast<const char*>(data), size);
+		if (Handle && Buffer.size() >= SBufferSize)
+			Flush();
+	}
+	void PutUInt(uint v) { Put(&v, sizeof(v)); }
+	void PutUInt64(uint64 v) { Put(&v, sizeof(v)); }
+	void PutString(const std::string& v) { PutUInt((uint)v.size()); Put(v.data(), v.size()); }
+	template <class T_>
+	void PutArray(const std::vector<T_>& v) { PutUInt((uint)v.size()); Put(v.data(), v.size() * sizeof(T_)); }
+
+	uint64 GetPosition() const { return Written + Buffer.size(); }
+
+	// Output of a writer without a file.
+	const std::string& GetBuffer() const { assert(!Handle); return Buffer; }
+	void Clear() { assert(!Handle); Buffer.clear(); }
+
+	void Finish()
+	{
+		Flush();
+		const bool failed = ferror(Handle) != 0;
+		fclose(Handle);
+		Handle = nullptr;
+		if (failed)
+			BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("write error", File, 0));
+	}
+
+private:
+	static const size_t SBufferSize = 1 << 20;
+
+	void Flush()
+	{
+		fwrite(Buffer.data(), 1, Buffer.size(), Handle);
+		Written += Buffer.size();
+		Buffer.clear();
+	}
+
+	const std::string File;
+	FILE* Handle;
+	std::string Buffer;
+	uint64 Written;
+};
+
+// Read-only memory mapping of a whole file.
+class cMappedFile
+{
+public:
+	explicit cMappedFile(const char* file)
+		: Data(nullptr)
+		, Size(0)
+#ifdef _WIN32
+		, File(INVALID_HANDLE_VALUE)
+		, Mapping(nullptr)
+#endif
+	{
+#ifdef _WIN32
+		File = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER size;
+		if (File == INVALID_HANDLE_VALUE || !GetFileSizeEx(File, &size))
+			Fail("cannot open file", file);
+		Size = (size_t)size.QuadPart;
+		if (Size)
+		{
+			Mapping = CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (Mapping)
+				Data = static_cast<const char*>(MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+			if (!Data)
+				Fail("cannot map file", file);
+		}
+#else
+		const int fd = open(file, O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0)
+		{
+			if (fd >= 0)
+				close(fd);
+			Fail("cannot open file", file);
+		}
+		Size = (size_t)st.st_size;
+		if (Size)
+		{
+			void* p = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+				Data = static_cast<const char*>(p);
+		}
+		close(fd);
+		if (Size && !Data)
+			Fail("cannot map file", file);
+#endif
+	}
+
+	~cMappedFile() { Unmap(); }
+
+	const char* GetData() const { return Data; }
+	size_t GetSize() const { return Size; }
+
+private:
+	cMappedFile(const cMappedFile&);
+	cMappedFile& operator=(const cMappedFile&);
+
+	void Unmap()
+	{
+#ifdef _WIN32
+		if (Data)
+			UnmapViewOfFile(Data);
+		if (Mapping)
+			CloseHandle(Mapping);
+		if (File != INVALID_HANDLE_VALUE)
+			CloseHandle(File);
+#else
+		if (Data)
+			munmap(const_cast<char*>(Data), Size);
+#endif
+	}
+
+	void Fail(const char* message, const char* file)
+	{
+		Unmap();
+		BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error(message, file, 0));
+	}
+
+	const char* Data;
+	size_t Size;
+#ifdef _WIN32
+	HANDLE File;
+	HANDLE Mapping;
+#endif
+};
+
+// rename() which atomically replaces an existing 'to'.
+inline void MoveFileReplacing(const char* from, const char* to)
+{
+#ifdef _WIN32
+	const bool moved = MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	const bool moved = rename(from, to) == 0;
+#endif
+	if (!moved)
+		BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("cannot replace file", to, 0));
+}
+
+// Flushes what was written to 'file' to the disk.
+inline void SyncFile(const char* file)
+{
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(file, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	const bool synced = handle != INVALID_HANDLE_VALUE && FlushFileBuffers(handle) != 0;
+	if (handle != INVALID_HANDLE_VALUE)
+		CloseHandle(handle);
+#else
+	const int handle = open(file, O_RDONLY);
+	const bool synced = handle >= 0 && fsync(handle) == 0;
+	if (handle >= 0)
+		close(handle);
+#endif
+	if (!synced)
+		BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("cannot sync file", file, 0));
+}
+
+// Makes files created, renamed or removed in the directory of 'file' so far survive a power
+// loss. MoveFileReplacing() writes through on Windows, where there is nothing left to do.
+inline void SyncDirectoryOf(const char* file)
+{
+#ifndef _WIN32
+	const std::string path(file);
+	const size_t slash = path.rfind('/');
+	const std::string directory = (slash == std::string::npos) ? "." : path.substr(0, slash ? slash : 1);
+	const int handle = open(directory.c_str(), O_RDONLY);
+	const bool synced = handle >= 0 && fsync(handle) == 0;
+	if (handle >= 0)
+		close(handle);
+	if (!synced)
+		BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("cannot sync directory", directory, 0));
+#endif
+}
+
+// MoveFileReplacing() surviving a power loss at any point: 'from' is on the disk before it
+// replaces 'to', and the replacement is when this returns.
+inline void MoveFileDurably(const char* from, const char* to)
+{
+	SyncFile(from);
+	MoveFileReplacing(from, to);
+	SyncDirectoryOf(to);
+}
+
+inline bool FileExists(const char* file)
+{
+	FILE* f = fopen(file, "rb");
+	if (f)
+		fclose(f);
+	return f != nullptr;
+}
+
+// Notices changes to files without blocking. Watches their directories, so files that
+// editors replace (write a temporary, then rename it) are noticed as well.
+class cFileWatcher
+{
+public:
+	cFileWatcher()
+	{
+#ifndef _WIN32
+		Handle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (Handle < 0)
+			BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("cannot watch files", "", 0));
+#endif
+	}
+
+	~cFileWatcher()
+	{
+#ifdef _WIN32
+		for (auto& directory : Directories)
+			FindCloseChangeNotification(directory.Handle);
+#else
+		close(Handle);
+#endif
+	}
+
+	void Add(const std::string& file)
+	{
+		for (auto& f : Files)
+			if (f.Path == file)
+				return;
+
+#ifdef _WIN32
+		const size_t slash = file.find_last_of("/\\");
+#else
+		const size_t slash = file.rfind('/');
+#endif
+		const std::string path = (slash == std::string::npos) ? "." : file.substr(0, slash ? slash : 1);
+		cFile f;
+		f.Path = file;
+		f.Name = file.substr(slash + 1);
+		f.Directory = 0;
+		f.Changed = false;
+		while (f.Directory < Directories.size() && Directories[f.Directory].Path != path)
+			++f.Directory;
+		if (f.Directory == Directories.size())
+		{
+			cDirectory directory;
+			directory.Path = path;
+#ifdef _WIN32
+			directory.Handle = FindFirstChangeNotificationA(path.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+			if (directory.Handle == INVALID_HANDLE_VALUE)
+#else
+			directory.Watch = inotify_add_watch(Handle, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+			if (directory.Watch < 0)
+#endif
+				BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("cannot watch directory", path, 0));
+			Directories.push_back(directory);
+		}
+#ifdef _WIN32
+		f.Time = GetWriteTime(file);
+#endif
+		Files.push_back(f);
+	}
+
+	// Files changed since the last call, each once, as they were added.
+	void Poll(std::vector<std::string>& changed)
+	{
+#ifdef _WIN32
+		for (size_t d = 0; d < Directories.size(); ++d)
+		{
+			if (WaitForSingleObject(Directories[d].Handle, 0) != WAIT_OBJECT_0)
+				continue;
+			FindNextChangeNotification(Directories[d].Handle);
+			for (auto& f : Files)
+			{
+				if (f.Directory != d)
+					continue;
+				const uint64 time = GetWriteTime(f.Path);
+				f.Changed = f.Changed || time != f.Time;
+				f.Time = time;
+			}
+		}
+#else
+		PTREE_ALIGN(8) char buffer[4096];
+		for (;;)
+		{
+			const ssize_t size = read(Handle, buffer, sizeof(buffer));
+			if (size <= 0)
+				break;
+			for (ssize_t i = 0; i < size;)
+			{
+				const inotify_event& event = *reinterpret_cast<const inotify_event*>(buffer + i);
+				i += sizeof(inotify_event) + event.len;
+				for (auto& f : Files)
+				{
+					// Dropped events may have been about any file.
+					if (event.mask & IN_Q_OVERFLOW)
+						f.Changed = true;
+					else if (event.len && Directories[f.Directory].Watch == event.wd && f.Name == event.name)
+						f.Changed = true;
+				}
+			}
+		}
+#endif
+		for (auto& f : Files)
+		{
+			if (f.Changed)
+				changed.push_back(f.Path);
+			f.Changed = false;
+		}
+	}
+
+private:
+	cFileWatcher(const cFileWatcher&);
+	cFileWatcher& operator=(const cFileWatcher&);
+
+	struct cDirectory
+	{
+		std::string Path;
+#ifdef _WIN32
+		HANDLE Handle;
+#else
+		int Watch;
+#endif
+	};
+
+	struct cFile
+	{
+		std::string Path;
+		std::string Name;
+		size_t Directory;
+		bool Changed;
+#ifdef _WIN32
+		uint64 Time;
+#endif
+	};
+
+#ifdef _WIN32
+	static uint64 GetWriteTime(const std::string& file)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExA(file.c_str(), GetFileExInfoStandard, &data))
+			return 0;
+		return ((uint64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	}
+#else
+	int Handle;
+#endif
+	std::vector<cDirectory> Directories;
+	std::vector<cFile> Files;
+};
+
+// Bounds checked reading from a block of memory, typically a cMappedFile.
+class cBinaryReader
+{
+public:
+	cBinaryReader(const char* data, size_t size, const std::string& file)
+		: File(file)
+		, Data(data)
+		, Size(size)
+		, Position(0)
+	{
+	}
+
+	const char* Take(size_t size)
+	{
+		if (size > Size - Position)
+			Fail("unexpected end of file");
+		const char* p = Data + Position;
+		Position += size;
+		return p;
+	}
+	void Get(void* v, size_t size) { memcpy(v, Take(size), size); }
+	uint GetUInt() { uint v; Get(&v, sizeof(v)); return v; }
+	uint64 GetUInt64() { uint64 v; Get(&v, sizeof(v)); return v; }
+	void GetString(std::string& v) { const uint size = GetUInt(); v.assign(Take(size), size); }
+	void GetString(cSharedString& v) { const uint size = GetUInt(); v.Assign(Take(size), size); }
+	// uint count followed by the elements, 'size' bytes each.
+	const char* TakeArray(size_t size, uint& count)
+	{
+		count = GetUInt();
+		if (count > (Size - Position) / size)
+			Fail("unexpected end of file");
+		return Take(count * size);
+	}
+	template <class T_>
+	void GetArray(std::vector<T_>& v)
+	{
+		uint count;
+		const char* data = TakeArray(sizeof(T_), count);
+		v.resize(count);
+		if (count)
+			memcpy(v.data(), data, count * sizeof(T_));
+	}
+
+	size_t GetPosition() const { return Position; }
+	void Seek(size_t position)
+	{
+		if (position > Size)
+			Fail("unexpected end of file");
+		Position = position;
+	}
+
+	// Reading stops at 'end', e.g. where a trailing section starts.
+	void Limit(size_t end)
+	{
+		if (end > Size)
+			Fail("unexpected end of file");
+		Size = end;
+	}
+
+	size_t GetSize() const { return Size; }
+	bool IsEnd() const { return Position == Size; }
+
+	void Fail(const char* message) const { BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error(message, File, 0)); }
+
+private:
+	const std::string File;
+	const char* Data;
+	size_t Size;
+	size_t Position;
+};
+
+// Native binary snapshot of a cObjectSystem:
+//
+//	header		"PTSB", uint version
+//	names		uint count, { string }						every property name, once
+//	types		uint count, { string name, uint objects, layout }
+//	layout		uint count, { uint name, uint type, [layout of an ePTCollection] }
+//	objects		{ uint type, values in layout order }
+//	index		uint64 offset[objects], uint type[objects]		version 2+
+//	footer		uint64 index offset, uint objects				version 2+
+//
+// int/uint are 4 bytes, Vector3 is three floats, strings are a uint length followed by the
+// characters, arrays (version 3+) a uint count followed by the elements. Everything is
+// stored in native byte order. The index gives random access to
+// single objects, see cLazySnapshot.
+class cBinarySnapshot
+{
+public:
+	static const uint SVersion = 3;
+
+	struct cField
+	{
+		uint Name;
+		uint Type;
+		uint Children;	// Number of nested fields following an ePTCollection, recursively.
+	};
+
+	struct cType
+	{
+		std::string Name;
+		uint Objects;
+		std::vector<cField> Layout;	// Pre-order.
+	};
+
+	typedef std::vector<cType> tTypes;
+
+public:
+	cBinarySnapshot() : Version(SVersion) {}
+
+	uint AddType(const std::string& name, const cPropertySchema& schema, uint objects)
+	{
+		cType type;
+		type.Name = name;
+		type.Objects = objects;
+		AddLayout(schema, type.Layout);
+		Types.push_back(type);
+		return (uint)Types.size() - 1;
+	}
+
+	const tTypes& GetTypes() const { return Types; }
+	const std::string& GetName(uint i) const { return Names[i]; }
+
+	bool HasIndex() const { return Version >= 2; }
+	size_t GetObjectCount() const { return Offsets.size(); }
+	uint64 GetObjectOffset(size_t i) const { return Offsets[i]; }
+	uint GetObjectType(size_t i) const { return ObjectTypes[i]; }
+
+	// Starts an object record and adds it to the index.
+	void BeginObject(cBinaryWriter& w, uint type)
+	{
+		Offsets.push_back(w.GetPosition());
+		ObjectTypes.push_back(type);
+		w.PutUInt(type);
+	}
+
+	void WriteIndex(cBinaryWriter& w) const
+	{
+		const uint64 index = w.GetPosition();
+		w.Put(Offsets.data(), Offsets.size() * sizeof(uint64));
+		w.Put(ObjectTypes.data(), ObjectTypes.size() * sizeof(uint));
+		w.PutUInt64(index);
+		w.PutUInt((uint)Offsets.size());
+	}
+
+	void Write(cBinaryWriter& w) const
+	{
+		w.Put("PTSB", 4);
+		w.PutUInt(SVersion);
+		w.PutUInt((uint)Names.size());
+		for (auto& name : Names)
+			w.PutString(name);
+		w.PutUInt((uint)Types.size());
+		for (auto& type : Types)
+		{
+			w.PutString(type.Name);
+			w.PutUInt(type.Objects);
+			w.PutUInt((uint)type.Layout.size());
+			w.Put(type.Layout.data(), type.Layout.size() * sizeof(cField));
+		}
+	}
+
+	void Read(cBinaryReader& r)
+	{
+		if (memcmp(r.Take(4), "PTSB", 4) != 0)
+			r.Fail("not a binary snapshot");
+		Version = r.GetUInt();
+		if (Version < 1 || Version > SVersion)
+			r.Fail("unsupported snapshot version");
+
+		Names.resize(r.GetUInt());
+		for (auto& name : Names)
+			r.GetString(name);
+		Types.resize(r.GetUInt());
+		for (auto& type : Types)
+		{
+			r.GetString(type.Name);
+			type.Objects = r.GetUInt();
+			type.Layout.resize(r.GetUInt());
+			if (!type.Layout.empty())
+				r.Get(type.Layout.data(), type.Layout.size() * sizeof(cField));
+			for (auto& field : type.Layout)
+				if (field.Name >= Names.size() || field.Type >= cProperty::ePTTypeCount)
+					r.Fail("corrupted type table");
+			if (!IsNested(type.Layout))
+				r.Fail("corrupted type table");
+		}
+
+		if (HasIndex())
+			ReadIndex(r);
+	}
+
+	// Bytes taken by a fixed size value, 0 for strings, collections and arrays.
+	static size_t GetSize(uint type)
+	{
+		switch (type)
+		{
+		case cProperty::ePTInt: return sizeof(int);
+		case cProperty::ePTUInt: return sizeof(uint);
+		case cProperty::ePTVector3: return sizeof(Vector3);
+		default: return 0;
+		}
+	}
+
+	// Bytes taken by an element of an array, 0 for other types.
+	static size_t GetElementSize(uint type)
+	{
+		switch (type)
+		{
+		case cProperty::ePTIntArray: return sizeof(int);
+		case cProperty::ePTUIntArray: return sizeof(uint);
+		case cProperty::ePTFloatArray: return sizeof(float);
+		case cProperty::ePTVector3Array: return sizeof(Vector3);
+		default: return 0;
+		}
+	}
+
+	// Writes the values of 'properties' in layout order.
+	static void WriteValues(cBinaryWriter& w, const cPropertySet& properties)
+	{
+		for (cProperty p : properties)
+			WriteValue(w, p);
+	}
+
+	static void WriteValue(cBinaryWriter& w, const cProperty& p)
+	{
+		switch (p.GetType())
+		{
+		case cProperty::ePTInt: { const int v = p.GetValue<int>(); w.Put(&v, sizeof(v)); } break;
+		case cProperty::ePTUInt: w.PutUInt(p.GetValue<uint>()); break;
+		case cProperty::ePTVector3: w.Put(&p.GetValue<const Vector3&>(), sizeof(Vector3)); break;
+		case cProperty::ePTString: { const char* v = p.GetValue<const char*>(); const uint n = (uint)strlen(v); w.PutUInt(n); w.Put(v, n); } break;
+		case cProperty::ePTCollection: WriteValues(w, p.GetValue<cPropertySet>()); break;
+		case cProperty::ePTIntArray: w.PutArray(p.GetValue<const tIntArray&>()); break;
+		case cProperty::ePTUIntArray: w.PutArray(p.GetValue<const tUIntArray&>()); break;
+		case cProperty::ePTFloatArray: w.PutArray(p.GetValue<const tFloatArray&>()); break;
+		case cProperty::ePTVector3Array: w.PutArray(p.GetValue<const tVector3Array&>()); break;
+		default: assert(false);
+		}
+	}
+
+	// Reads a value written by WriteValue() through the property's setter.
+	static void ReadValue(cBinaryReader& r, cProperty& p)
+	{
+		switch (p.GetType())
+		{
+		case cProperty::ePTInt: { int v; r.Get(&v, sizeof(v)); p.SetValue(v); } break;
+		case cProperty::ePTUInt: p.SetValue(r.GetUInt()); break;
+		case cProperty::ePTVector3: { Vector3 v; r.Get(&v, sizeof(v)); p.SetValue(v); } break;
+		case cProperty::ePTString: { std::string v; r.GetString(v); p.SetValue(v.c_str()); } break;
+		case cProperty::ePTCollection:
+			for (cProperty member : p.GetValue<cPropertySet>())
+				ReadValue(r, member);
+			break;
+		case cProperty::ePTIntArray: ReadArray<int>(r, p); break;
+		case cProperty::ePTUIntArray: ReadArray<uint>(r, p); break;
+		case cProperty::ePTFloatArray: ReadArray<float>(r, p); break;
+		case cProperty::ePTVector3Array: ReadArray<Vector3>(r, p); break;
+		default: assert(false);
+		}
+	}
+
+private:
+	template <class T_>
+	static void ReadArray(cBinaryReader& r, cProperty& p)
+	{
+		std::vector<T_> v;
+		r.GetArray(v);
+		p.SetValue(std::move(v));
+	}
+
+	uint AddName(const char* name)
+	{
+		auto it = NameIndices.insert(std::make_pair(std::string(name), (uint)Names.size()));
+		if (it.second)
+			Names.push_back(it.first->first);
+		return it.first->second;
+	}
+
+	void AddLayout(const cPropertySchema& schema, std::vector<cField>& layout)
+	{
+		for (const cPropertyDescriptor* d = schema.Begin(); d != schema.End(); ++d)
+		{
+			const size_t i = layout.size();
+			cField field = { AddName(d->Name), (uint)d->Type, 0 };
+			layout.push_back(field);
+			if (d->Type == cProperty::ePTCollection)
+			{
+				AddLayout(*d->Schema, layout);
+				layout[i].Children = (uint)(layout.size() - i - 1);
+			}
+		}
+	}
+
+	// Whether the nested fields of each collection fit within the fields of the collection,
+	// or of the layout, around it, so walking them recursively stays inside 'layout'.
+	// Nesting deeper than any schema would is rejected as well, for the sake of the stack.
+	static bool IsNested(const std::vector<cField>& layout)
+	{
+		static const size_t SMaxDepth = 64;
+
+		std::vector<size_t> ends;
+		for (size_t i = 0; i < layout.size(); ++i)
+		{
+			while (!ends.empty() && ends.back() == i)
+				ends.pop_back();
+			const size_t end = ends.empty() ? layout.size() : ends.back();
+			const cField& field = layout[i];
+			if (field.Type != cProperty::ePTCollection)
+			{
+				if (field.Children != 0)
+					return false;
+			}
+			else if (field.Children > end - i - 1 || ends.size() == SMaxDepth)
+				return false;
+			else if (field.Children)
+				ends.push_back(i + 1 + field.Children);
+		}
+		return true;
+	}
+
+	// Reads the index and leaves 'r' limited to the object records.
+	void ReadIndex(cBinaryReader& r)
+	{
+		const size_t objects = r.GetPosition();
+		const size_t footer = sizeof(uint64) + sizeof(uint);
+		if (r.GetSize() < objects + footer)
+			r.Fail("unexpected end of file");
+
+		r.Seek(r.GetSize() - footer);
+		const uint64 index = r.GetUInt64();
+		const uint count = r.GetUInt();
+		if (index < objects || index > r.GetSize() - footer || (r.GetSize() - footer - index) != count * (sizeof(uint64) + sizeof(uint)))
+			r.Fail("corrupted object index");
+
+		r.Seek((size_t)index);
+		Offsets.resize(count);
+		ObjectTypes.resize(count);
+		if (count)
+		{
+			r.Get(Offsets.data(), count * sizeof(uint64));
+			r.Get(ObjectTypes.data(), count * sizeof(uint));
+		}
+		for (uint i = 0; i < count; ++i)
+			if (ObjectTypes[i] >= Types.size() || Offsets[i] < objects || Offsets[i] >= index)
+				r.Fail("corrupted object index");
+
+		r.Seek(objects);
+		r.Limit((size_t)index);
+	}
+
+	uint Version;
+	std::vector<std::string> Names;
+	std::unordered_map<std::string, uint> NameIndices;
+	tTypes Types;
+	std::vector<uint64> Offsets;
+	std::vector<uint> ObjectTypes;
+};
+
+// How to load the values of one snapshot type into objects of the current schema. Fields are
+// matched by name and type; fields the class no longer has are skipped, properties missing
+// from the file keep their defaults. Adjacent fixed size fields that are adjacent in memory
+// too are copied with a single memcpy.
+class cBinaryLoadPlan
+{
+public:
+	cBinaryLoadPlan(const cBinarySnapshot& snapshot, const cBinarySnapshot::cType& type, const cPropertySchema* schema)
+	{
+		size_t i = 0;
+		Build(snapshot, type.Layout, i, type.Layout.size(), schema, SNone, 0, 0);
+	}
+
+	void Load(cBinaryReader& r, char* object) const
+	{
+		for (auto& op : ObjectOps)
+			Apply(r, op, object + op.Offset);
+	}
+
+	// Also handles rows of columns, where values are not at schema offsets from one object.
+	void Load(cBinaryReader& r, const cPropertySet& properties) const
+	{
+		if (char* object = static_cast<char*>(properties.GetObject()))
+		{
+			Load(r, object);
+			return;
+		}
+		for (auto& op : ColumnOps)
+			Apply(r, op, (op.Op == eCopy || op.Op == eString || op.Op == eArray) ? static_cast<char*>(properties.GetValue(op.Property)) + op.Offset : nullptr);
+	}
+
+private:
+	enum eOp
+	{
+		eCopy = 0,
+		eString,
+		eArray,
+		eSkip,
+		eSkipString,
+		eSkipArray
+	};
+
+	static const size_t SNone = ~(size_t)0;
+
+	typedef void (*tReadArray)(cBinaryReader& r, char* value);
+
+	struct cOp
+	{
+		eOp Op;
+		size_t Property;	// Top level property, for ColumnOps.
+		size_t Offset;
+		size_t Size;		// Of the element for arrays.
+		tReadArray ReadArray;
+	};
+
+	static void Apply(cBinaryReader& r, const cOp& op, char* value)
+	{
+		uint count;
+		switch (op.Op)
+		{
+		case eCopy: memcpy(value, r.Take(op.Size), op.Size); break;
+		case eString: r.GetString(*reinterpret_cast<cSharedString*>(value)); break;
+		case eArray: op.ReadArray(r, value); break;
+		case eSkip: r.Take(op.Size); break;
+		case eSkipString: r.Take(r.GetUInt()); break;
+		case eSkipArray: r.TakeArray(op.Size, count); break;
+		}
+	}
+
+	template <class T_>
+	static void ReadArray(cBinaryReader& r, char* value) { r.GetArray(*reinterpret_cast<std::vector<T_>*>(value)); }
+
+	static tReadArray GetReadArray(uint type)
+	{
+		switch (type)
+		{
+		case cProperty::ePTIntArray: return &ReadArray<int>;
+		case cProperty::ePTUIntArray: return &ReadArray<uint>;
+		case cProperty::ePTFloatArray: return &ReadArray<float>;
+		case cProperty::ePTVector3Array: return &ReadArray<Vector3>;
+		default: return nullptr;
+		}
+	}
+
+	// Offsets are tracked both from the object and from the top level property's value.
+	void Build(const cBinarySnapshot& snapshot, const std::vector<cBinarySnapshot::cField>& layout, size_t& i, size_t end, const cPropertySchema* schema, size_t property, size_t objectBase, size_t valueBase)
+	{
+		while (i < end)
+		{
+			const cBinarySnapshot::cField& field = layout[i++];
+			const cPropertyDescriptor* d = schema ? Find(*schema, snapshot.GetName(field.Name), field.Type) : nullptr;
+			size_t top = property;
+			size_t objectOffset = 0;
+			size_t valueOffset = 0;
+			if (d)
+			{
+				objectOffset = objectBase + d->Offset;
+				if (property == SNone)
+					top = d - schema->Begin();
+				else
+					valueOffset = valueBase + d->Offset;
+			}
+
+			switch (field.Type)
+			{
+			case cProperty::ePTString: Add(d ? eString : eSkipString, top, objectOffset, valueOffset, 0); break;
+			case cProperty::ePTCollection: Build(snapshot, layout, i, i + field.Children, d ? d->Schema : nullptr, top, objectOffset, valueOffset); break;
+			case cProperty::ePTIntArray:
+			case cProperty::ePTUIntArray:
+			case cProperty::ePTFloatArray:
+			case cProperty::ePTVector3Array:
+				Add(d ? eArray : eSkipArray, top, objectOffset, valueOffset, cBinarySnapshot::GetElementSize(field.Type), GetReadArray(field.Type));
+				break;
+			default: Add(d ? eCopy : eSkip, top, objectOffset, valueOffset, cBinarySnapshot::GetSize(field.Type)); break;
+			}
+		}
+	}
+
+	static const cPropertyDescriptor* Find(const cPropertySchema& schema, const std::string& name, uint type)
+	{
+		for (const cPropertyDescriptor* d = schema.Begin(); d != schema.End(); ++d)
+			if ((uint)d->Type == type && name == d->Name)
+				return d;
+		return nullptr;
+	}
+
+	void Add(eOp op, size_t property, size_t objectOffset, size_t valueOffset, size_t size, tReadArray readArray = nullptr)
+	{
+		Add(ObjectOps, op, 0, objectOffset, size, readArray);
+		Add(ColumnOps, op, property, valueOffset, size, readArray);
+	}
+
+	static void Add(std::vector<cOp>& ops, eOp op, size_t property, size_t offset, size_t size, tReadArray readArray)
+	{
+		if (!ops.empty())
+		{
+			cOp& last = ops.back();
+			if (op == eCopy && last.Op == eCopy && last.Property == property && last.Offset + last.Size == offset)
+			{
+				last.Size += size;
+				return;
+			}
+			if (op == eSkip && last.Op == eSkip)
+			{
+				last.Size += size;
+				return;
+			}
+		}
+		cOp o = { op, property, offset, size, readArray };
+		ops.push_back(o);
+	}
+
+	std::vector<cOp> ObjectOps;
+	std::vector<cOp> ColumnOps;		// Copies never span two top level properties.
+};
+
+// A mapped snapshot serving as iPropertySource: objects are registered as stubs and each one
+// is loaded from the mapping on first access. Only the IDs of untouched objects are read.
+class cLazySnapshot : public iPropertySource
+{
+public:
+	explicit cLazySnapshot(const char* file)
+		: File(file)
+		, Mapping(file)
+	{
+		cBinaryReader r(Mapping.GetData(), Mapping.GetSize(), File);
+		Snapshot.Read(r);
+		if (!Snapshot.HasIndex())
+			r.Fail("snapshot has no object index");
+	}
+
+	const cBinarySnapshot& GetSnapshot() const { return Snapshot; }
+
+	// Plans are added in snapshot type order; a null schema skips the type.
+	void AddPlan(const cPropertySchema* schema)
+	{
+		const cBinarySnapshot::cType& type = Snapshot.GetTypes()[Plans.size()];
+		Plans.push_back(cBinaryLoadPlan(Snapshot, type, schema));
+		HasID.push_back(!type.Layout.empty() && type.Layout[0].Type == cProperty::ePTUInt && Snapshot.GetName(type.Layout[0].Name) == "ID");
+	}
+
+	// Reads just the ID of object 'index', false if its type does not start with one.
+	bool GetID(size_t index, uint& id) const
+	{
+		if (!HasID[Snapshot.GetObjectType(index)])
+			return false;
+		cBinaryReader r(Mapping.GetData(), Mapping.GetSize(), File);
+		r.Seek((size_t)Snapshot.GetObjectOffset(index) + sizeof(uint));
+		id = r.GetUInt();
+		return true;
+	}
+
+	// iPropertySource:
+	virtual void Load(const cPropertySet& properties, uint index) override
+	{
+		cBinaryReader r(Mapping.GetData(), Mapping.GetSize(), File);
+		r.Seek((size_t)Snapshot.GetObjectOffset(index));
+		const uint type = r.GetUInt();
+		if (type != Snapshot.GetObjectType(index))
+			r.Fail("corrupted object index");
+		Plans[type].Load(r, properties);
+	}
+	// iPropertySource.
+
+private:
+	const std::string File;
+	cMappedFile Mapping;
+	cBinarySnapshot Snapshot;
+	std::vector<cBinaryLoadPlan> Plans;
+	std::vector<bool> HasID;	// By type.
+};
+
+// Append-only log of object changes. Records are appended in blocks which are replayed
+// whole or not at all, so a crash in the middle of Append() loses only that block:
+//
+//	header		"PTSJ", uint version
+//	block		uint size, uint checksum, records[size]
+//	record		uint eDelete, uint id
+//				uint eObject, string type, uint id, uint64 dirty mask, flagged values
+//
+// Values are encoded as in cBinarySnapshot and matched to properties by schema position,
+// so compact the journal before changing a schema.
+class cJournal
+{
+public:
+	static const uint SVersion = 1;
+
+	enum eRecord
+	{
+		eDelete = 0,
+		eObject
+	};
+
+	// Starts an empty journal, replacing 'file'. Whatever 'file' held has to be safe
+	// elsewhere by now.
+	explicit cJournal(const char* file)
+		: File(file)
+		, Handle(fopen(file, "wb"))
+	{
+		if (!Handle)
+			BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("cannot open file", File, 0));
+		const uint version = SVersion;
+		fwrite("PTSJ", 1, 4, Handle);
+		fwrite(&version, sizeof(version), 1, Handle);
+		Sync();
+		// A new file is only there for good once its directory is.
+		SyncDirectoryOf(file);
+	}
+
+	~cJournal()
+	{
+		if (Handle)
+			fclose(Handle);
+	}
+
+	// Appends 'records' as one block and returns once it is on the disk.
+	void Append(const std::string& records)
+	{
+		if (records.empty())
+			return;
+		const uint header[2] = { (uint)records.size(), Checksum(records.data(), records.size()) };
+		fwrite(header, sizeof(header), 1, Handle);
+		fwrite(records.data(), 1, records.size(), Handle);
+		Sync();
+	}
+
+	// Calls replay() for each intact block, stopping at the first torn or corrupt one.
+	static void Read(const char* file, const std::function<void(cBinaryReader&)>& replay)
+	{
+		cMappedFile mapping(file);
+		cBinaryReader r(mapping.GetData(), mapping.GetSize(), file);
+		if (memcmp(r.Take(4), "PTSJ", 4) != 0)
+			r.Fail("not a journal");
+		if (r.GetUInt() != SVersion)
+			r.Fail("unsupported journal version");
+
+		while (r.GetSize() - r.GetPosition() >= 2 * sizeof(uint))
+		{
+			const uint size = r.GetUInt();
+			const uint checksum = r.GetUInt();
+			if (size > r.GetSize() - r.GetPosition())
+				break;
+			const char* records = r.Take(size);
+			if (Checksum(records, size) != checksum)
+				break;
+			cBinaryReader block(records, size, file);
+			replay(block);
+		}
+	}
+
+private:
+	cJournal(const cJournal&);
+	cJournal& operator=(const cJournal&);
+
+	// FNV-1a.
+	static uint Checksum(const char* data, size_t size)
+	{
+		uint h = 2166136261u;
+		for (size_t i = 0; i < size; ++i)
+			h = (h ^ (unsigned char)data[i]) * 16777619u;
+		return h;
+	}
+
+	void Sync()
+	{
+		bool failed = fflush(Handle) != 0;
+#ifdef _WIN32
+		failed |= _commit(_fileno(Handle)) != 0;
+#else
+		failed |= fsync(fileno(Handle)) != 0;
+#endif
+		if (failed || ferror(Handle))
+			BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("write error", File, 0));
+	}
+
+	const std::string File;
+	FILE* Handle;
+};
+
+class cObjectSystem
+{
+public:
+	struct iFactory
+	{
+		virtual ~iFactory() {}
+
+		virtual iBaseObject* Create(uint id, const char* name) = 0;
+		virtual void Destroy(iBaseObject* object) = 0;
+		virtual void Reserve(size_t count) = 0;
+		virtual const char* GetType() const = 0;
+		virtual tTypeId GetTypeId() const = 0;
+		virtual const cPropertySchema& GetSchema() const = 0;
+		// A factory for the same type with its own, empty pool.
+		virtual std::unique_ptr<iFactory> Clone() const = 0;
+
+		// Type specialized (de)serialization of objects created by this factory.
+		virtual void SaveXML(const iBaseObject& object, tBoostPTree& pt) const = 0;
+		virtual void SaveXML(const iBaseObject& object, cXMLWriter& writer) const = 0;
+		// Loads report to 'scope' instead of throwing when it is lenient, see cLoadScope.
+		virtual void LoadXML(iBaseObject& object, const tBoostPTree& pt, const cLoadScope& scope) const = 0;
+		virtual void LoadXML(iBaseObject& object, const tXMLNode& node, const cLoadScope& scope) const = 0;
+		// Loads only the properties present under 'node'.
+		virtual void LoadXMLDelta(iBaseObject& object, const tXMLNode& node, const cLoadScope& scope) const = 0;
+		// Variants of prototypes, 'other' being an object of this factory too: the copy takes
+		// every property, the save only those differing from 'prototype'.
+		virtual void CopyProperties(iBaseObject& object, const iBaseObject& other) const = 0;
+		virtual void SaveXMLDiff(const iBaseObject& object, const iBaseObject& prototype, cXMLWriter& writer) const = 0;
+	};
+
+	typedef std::unique_ptr<iFactory> rFactory;
+
+	template <class C_>
+	class cFactory : public iFactory
+	{
+	public:
+		cFactory(const char* type) : Type(type), TypeId(cTypeNames::Intern(type)) {}
+
+		// iFactory:
+		virtual iBaseObject* Create(uint id, const char* name) override { return new (Pool.Allocate()) C_(id); }
+		virtual void Destroy(iBaseObject* object) override
+		{
+			C_* o = static_cast<C_*>(object);
+			o->~C_();
+			Pool.Free(o);
+		}
+		virtual void Reserve(size_t count) override { Pool.Reserve(count); }
+		virtual const char* GetType() const override { return Type.c_str(); }
+		virtual tTypeId GetTypeId() const override { return TypeId; }
+		virtual const cPropertySchema& GetSchema() const override { return C_::SSchema; }
+		virtual std::unique_ptr<iFactory> Clone() const override { return std::unique_ptr<iFactory>(new cFactory<C_>(Type.c_str())); }
+		virtual void SaveXML(const iBaseObject& object, tBoostPTree& pt) const override
+		{
+			cStaticXMLSerializer saver(pt);
+			VisitProperties(static_cast<const C_&>(object), saver);
+		}
+		virtual void SaveXML(const iBaseObject& object, cXMLWriter& writer) const override
+		{
+			cStreamingXMLSerializer saver(writer);
+			VisitProperties(static_cast<const C_&>(object), saver);
+		}
+		virtual void LoadXML(iBaseObject& object, const tBoostPTree& pt, const cLoadScope& scope) const override
+		{
+			cStaticXMLDeserializer loader(pt, scope);
+			VisitProperties(static_cast<C_&>(object), loader);
+		}
+		virtual void LoadXML(iBaseObject& object, const tXMLNode& node, const cLoadScope& scope) const override
+		{
+			cXMLNodeDeserializer loader(node, false, scope);
+			VisitProperties(static_cast<C_&>(object), loader);
+		}
+		virtual void LoadXMLDelta(iBaseObject& object, const tXMLNode& node, const cLoadScope& scope) const override
+		{
+			cXMLNodeDeserializer loader(node, true, scope);
+			VisitProperties(static_cast<C_&>(object), loader);
+		}
+		virtual void CopyProperties(iBaseObject& object, const iBaseObject& other) const override
+		{
+			cPropertyCopier copier;
+			VisitPropertyPairs(static_cast<C_&>(object), static_cast<const C_&>(other), copier);
+		}
+		virtual void SaveXMLDiff(const iBaseObject& object, const iBaseObject& prototype, cXMLWriter& writer) const override
+		{
+			cStreamingXMLDiffSerializer saver(writer);
+			VisitPropertyPairs(static_cast<const C_&>(object), static_cast<const C_&>(prototype), saver);
+		}
+		// iFactory.
+
+	private:
+		const std::string Type;
+		const tTypeId TypeId;
+		cObjectPool<C_> Pool;
+	};
+
+	// cFactory keeping the properties of C_ in cPropertyColumns (structure of arrays) instead
+	// of in the objects. Opt in per type by registering it in place of cFactory<C_>. The
+	// objects keep their identity; their values move to a row of the columns, leaving the
+	// members at their defaults. GetProperties(), VisitProperties(), VisitPropertyPairs(),
+	// the (de)serializers built on them and Gather/Scatter all reach the row, so only the
+	// members themselves, as seen by C_'s own methods, do not hold the values: register only
+	// types whose methods go through their properties. C_ has to describe its cBaseObject
+	// first, the uint "ID" being the first column.
+	template <class C_>
+	class cColumnFactory : public cFactory<C_>
+	{
+	public:
+		static_assert(std::is_base_of<cBaseObject, C_>::value, "Columns hold the properties of cBaseObject types");
+
+		cColumnFactory(const char* type) : cFactory<C_>(type)
+		{
+			assert(C_::SSchema.GetSize() && strcmp(C_::SSchema[0].Name, "ID") == 0 && C_::SSchema[0].Type == cProperty::ePTUInt);
+		}
+
+		// iFactory:
+		virtual iBaseObject* Create(uint id, const char* name) override
+		{
+			C_* object = static_cast<C_*>(cFactory<C_>::Create(id, name));
+			object->SetPropertyStorage(Columns, Columns.Allocate(*object));
+			return object;
+		}
+		virtual void Destroy(iBaseObject* object) override
+		{
+			Columns.Free(static_cast<C_*>(object)->GetStorageRow());
+			cFactory<C_>::Destroy(object);
+		}
+		virtual void Reserve(size_t count) override
+		{
+			cFactory<C_>::Reserve(count);
+			Columns.Reserve(count);
+		}
+		virtual std::unique_ptr<iFactory> Clone() const override { return std::unique_ptr<iFactory>(new cColumnFactory<C_>(this->GetType())); }
+		virtual void SaveXML(const iBaseObject& object, tBoostPTree& pt) const override
+		{
+			cStaticXMLSerializer saver(pt);
+			Columns.Visit(GetRow(object), saver);
+		}
+		virtual void SaveXML(const iBaseObject& object, cXMLWriter& writer) const override
+		{
+			cStreamingXMLSerializer saver(writer);
+			Columns.Visit(GetRow(object), saver);
+		}
+		virtual void LoadXML(iBaseObject& object, const tBoostPTree& pt, const cLoadScope& scope) const override
+		{
+			cStaticXMLDeserializer loader(pt, scope);
+			Columns.Visit(GetRow(object), loader);
+		}
+		virtual void LoadXML(iBaseObject& object, const tXMLNode& node, const cLoadScope& scope) const override
+		{
+			cXMLNodeDeserializer loader(node, false, scope);
+			Columns.Visit(GetRow(object), loader);
+		}
+		virtual void LoadXMLDelta(iBaseObject& object, const tXMLNode& node, const cLoadScope& scope) const override
+		{
+			cXMLNodeDeserializer loader(node, true, scope);
+			Columns.Visit(GetRow(object), loader);
+		}
+		virtual void CopyProperties(iBaseObject& object, const iBaseObject& other) const override
+		{
+			cPropertyCopier copier;
+			Columns.Visit(GetRow(object), GetRow(other), copier);
+		}
+		virtual void SaveXMLDiff(const iBaseObject& object, const iBaseObject& prototype, cXMLWriter& writer) const override
+		{
+			cStreamingXMLDiffSerializer saver(writer);
+			Columns.Visit(GetRow(object), GetRow(prototype), saver);
+		}
+		// iFactory.
+
+		const cPropertyColumns<C_>& GetColumns() const { return Columns; }
+
+	private:
+		static uint GetRow(const iBaseObject& object) { return static_cast<const C_&>(object).GetStorageRow(); }
+
+		cPropertyColumns<C_> Columns;
+	};
+
+	// Registered object along with the factory that created it.
+	struct cEntry
+	{
+		cEntry(iBaseObject* object, iFactory* factory) : Object(object), Factory(factory), Position(0) {}
+
+		iBaseObject* Object;
+		iFactory* Factory;
+		size_t Position;	// In the objects of its type, see TypeObjects.
+	};
+
+	typedef cSlotMap<cEntry> tRegistry;
+	typedef tRegistry::cHandle tHandle;
+
+public:
+	cObjectSystem() : NextID(0), DirtyTracking(false), XMLBase64Arrays(false), Diagnostics(nullptr) {}
+	~cObjectSystem()
+	{
+		if (Compactor.joinable())
+			Compactor.join();
+		for (cEntry& entry : Registery)
+			entry.Factory->Destroy(entry.Object);
+	}
+
+	void SaveXML(const char* file);
+	void LoadXML(const char* file);
+
+	// SaveXML()/LoadXML() spread over the pool's threads. The file and the resulting registry
+	// order are the same as with the serial versions.
+	void SaveXML(const char* file, cWorkerPool& pool);
+	void LoadXML(const char* file, cWorkerPool& pool);
+
+	// Array properties are saved to XML as base64 of their raw elements instead of as text,
+	// which is smaller and faster to parse but neither portable nor readable. Loading takes
+	// either.
+	void SetXMLBase64Arrays(bool enable) { XMLBase64Arrays = enable; }
+
+	// Lenient XML loads: while set, LoadXML(), LoadXMLTree() and ConvertXMLToBinary() add
+	// properties they cannot read and prototypes they cannot resolve to 'diagnostics' in
+	// document order and go on, the properties keeping their defaults or their prototype's
+	// values. Files that do not open or parse still throw. Null for strict loads again.
+	void SetLoadDiagnostics(cLoadDiagnostics* diagnostics) { Diagnostics = diagnostics; }
+
+	// Hot reloading. WatchXML() takes the file as the state of the live objects, so call it
+	// right after loading it. PollXML() then reloads the watched files that changed on disk
+	// since, without blocking; ReloadXML() reloads one right away. A reload matches elements
+	// to objects by ID and compares each element's text with the state last loaded: only
+	// edited elements, and variants of edited prototypes, are loaded, and only properties
+	// whose values the edit changed are set, through cProperty, so the rest keeps what it was
+	// given at runtime. New elements are registered as new objects; removed elements, those
+	// without an ID and those whose ID now belongs to another type are left alone. A reload
+	// that fails to load changes nothing, the next one starts from the same state. Return
+	// the number of values set.
+	void WatchXML(const char* file);
+	size_t PollXML();
+	size_t ReloadXML(const char* file);
+
+	// SaveXML()/LoadXML() going through a full ptree and write_xml()/read_xml(). Same results,
+	// kept for reference; arrays are always saved as text.
+	void SaveXMLTree(const char* file);
+	void LoadXMLTree(const char* file);
+
+	// Native binary snapshots, see cBinarySnapshot.
+	void SaveBinary(const char* file);
+	void LoadBinary(const char* file);
+
+	// Maps a binary snapshot and registers its objects right away; each object reads its
+	// properties from the mapping on first GetProperties()/Hydrate(). The mapping lives as
+	// long as the object system.
+	void LoadBinaryLazy(const char* file);
+
+	// Incremental saves. Turning tracking on starts from a clean state; objects registered
+	// afterwards count as changed entirely, so enable it after loading the base file. The
+	// first change of an object lists it with the changed objects of its type, so while
+	// tracking, objects of one type are written from one thread at a time. Property sets
+	// bound before tracking was turned on flag their changes too.
+	void SetDirtyTracking(bool enable);
+	// Writes the objects and properties changed since tracking started or the last
+	// SaveDelta(), plus the IDs of deleted objects, and starts over. Objects are identified
+	// by ID:
+	//
+	//	<Delta><Deleted><ID>7</ID></Deleted><Actor><ID>3</ID><Health>20</Health></Actor></Delta>
+	void SaveDelta(const char* file);
+	// Applies a delta on top of the loaded base, without flagging anything as changed.
+	void ApplyDelta(const char* file);
+
+	// Crash safe persistence costing O(changes): a binary snapshot plus a cJournal of the
+	// changes since. OpenJournal() loads both into the system, starts over from a fresh
+	// snapshot and turns on dirty tracking, which is then owned by the journal (no
+	// SaveDelta() meanwhile). CommitJournal() appends the changes since the last commit and
+	// returns once they are durable.
+	void OpenJournal(const char* snapshotFile, const char* journalFile);
+	void CommitJournal();
+	// Commits, switches to a fresh journal and folds the previous one into a new snapshot on
+	// a background thread; commits go on meanwhile. Registering factories for new types has
+	// to wait for WaitForCompaction(), which also reports compaction errors.
+	void CompactJournal();
+	void WaitForCompaction();
+	void CloseJournal();
+
+	// Converters between the XML files and binary snapshots. They do not touch the registry.
+	void ConvertXMLToBinary(const char* xmlFile, const char* binaryFile);
+	static void ConvertBinaryToXML(const char* binaryFile, const char* xmlFile);
+
+	template <class C_>
+	tHandle Create(const char* name)
+	{
+		if (iFactory* f = FindFactory(cTypeNames::Of<C_>()))
+			return RegisterObject(*f->Create(NextID++, name), *f);
+		return tHandle();
+	}
+
+	// Creates 'count' objects with registry and pool capacity reserved up front.
+	template <class C_>
+	void CreateN(size_t count, const char* name, std::vector<tHandle>* handles = nullptr)
+	{
+		iFactory* f = FindFactory(cTypeNames::Of<C_>());
+		if (!f)
+			return;
+
+		ReserveObjects(count);
+		f->Reserve(count);
+		if (handles)
+			handles->reserve(handles->size() + count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			tHandle h = RegisterObject(*f->Create(NextID++, name), *f);
+			if (handles)
+				handles->push_back(h);
+		}
+	}
+
+	// Returns nullptr for null or stale handles.
+	template <class C_>
+	C_* Get(tHandle h) const
+	{
+		const cEntry* entry = Registery.Find(h);
+		return entry ? static_cast<C_*>(entry->Object) : nullptr;
+	}
+
+	// Batched change notifications. While any observer is added, the first write of each
+	// property of a registered object through its cProperty setters is recorded for the
+	// writing thread, later writes until the flush only find it recorded. FlushChanges(),
+	// called once per frame while no other thread writes, hands every observer all the
+	// records in one batch and returns their number. Members written directly, Scatter() and
+	// loads are not reported. Without observers setters cost what they did. Removing the last
+	// observer drops the pending records. Setters flag their object without atomics, so each
+	// object is written from one thread at a time between flushes. Property sets bound
+	// before the first observer was added report as well.
+	void AddObserver(iPropertyObserver& observer);
+	void RemoveObserver(iPropertyObserver& observer);
+	size_t FlushChanges() { return ChangeQueue ? ChangeQueue->Flush(Observers) : 0; }
+
+	void Delete(tHandle& h)
+	{
+		if (const cEntry* entry = Registery.Find(h))
+		{
+			if (DirtyTracking)
+			{
+				entry->Object->Hydrate();
+				DeletedIDs.push_back(entry->Object->GetID());
+			}
+			Release(h);
+		}
+		h = tHandle();
+	}
+
+	// Prototypes (archetypes): an object can be a variant of another object of its type.
+	// SaveXML() writes variants with a reference to the prototype's ID and only the
+	// properties differing from it:
+	//
+	//	<Actor prototype="0"><ID>7</ID><Name>Lesser Termogoyf</Name><Health>58</Health></Actor>
+	//
+	// LoadXML() starts such an element from a copy of its prototype, which is in the same file
+	// or already registered, and loads what the element holds on top; without an ID it gets a
+	// new one. Copies share string data until changed. Values are copied, not looked up, so
+	// changes to a prototype reach its variants only through saving and loading them again.
+	// Deleting a prototype links its variants to its own prototype. Binary snapshots,
+	// deltas and the ptree paths keep complete objects and no links.
+	//
+	// A null 'prototype' unlinks. Fails for stale handles, other types and cycles.
+	bool SetPrototype(tHandle object, tHandle prototype);
+	// Registers a variant of 'prototype' holding all its values, under a new ID.
+	tHandle Instantiate(tHandle prototype);
+
+	// Copies of an object under new IDs, without going through any serialization: values are
+	// copied member-wise as its factory's CopyProperties() does, collections deeply, strings
+	// shared until changed. A clone of a variant is a variant of the same prototype.
+	// CloneN() reserves registry and pool capacity for all clones up front, so they are
+	// allocated in one contiguous batch. Null handles, or none added, for stale ones.
+	tHandle Clone(tHandle object);
+	void CloneN(tHandle object, size_t count, std::vector<tHandle>* handles = nullptr);
+
+	// Columnar access to one property of every object of a type. Both walk just the objects
+	// of the type, in the same order, which only registering and deleting objects of the type
+	// change. The property is resolved once; values are then copied straight between the
+	// objects and the contiguous array. Both return the number of objects of the type and
+	// copy at most 'count' values; Gather() with a null 'out' only counts. Unknown types,
+	// names or a mismatching T_ copy nothing.
+	template <class T_>
+	size_t Gather(const char* property, tTypeId type, T_* out, size_t count)
+	{
+		size_t index;
+		const cPropertyDescriptor* d = FindColumn<T_>(property, type, index);
+		if (!d)
+			return 0;
+
+		const tTypeObjects& objects = TypeObjects[type];
+		if (out)
+		{
+			cColumnCursor cursor(index);
+			for (size_t i = 0, n = std::min(count, objects.size()); i < n; ++i)
+				out[i] = *reinterpret_cast<const T_*>(GetColumnValue(*objects[i].Object, cursor));
+		}
+		return objects.size();
+	}
+
+	template <class T_>
+	size_t Scatter(const char* property, tTypeId type, const T_* in, size_t count)
+	{
+		size_t index;
+		const cPropertyDescriptor* d = FindColumn<T_>(property, type, index);
+		if (!d)
+			return 0;
+
+		const tTypeObjects& objects = TypeObjects[type];
+		const tDirtyMask dirty = GetDirtyBit(index);
+		cColumnCursor cursor(index);
+		for (size_t i = 0, n = std::min(count, objects.size()); i < n; ++i)
+		{
+			*reinterpret_cast<T_*>(GetColumnValue(*objects[i].Object, cursor)) = in[i];
+			if (DirtyTracking)
+				objects[i].Object->MarkDirty(dirty);
+		}
+		return objects.size();
+	}
+
+	void RegisterFactory(rFactory f)
+	{
+		const tTypeId id = f->GetTypeId();
+		if (id >= Factories.size())
+		{
+			Factories.resize(id + 1);
+			Dirtied.resize(id + 1);
+			TypeObjects.resize(id + 1);
+		}
+		Factories[id] = std::move(f);
+		if (!Dirtied[id])
+			Dirtied[id].reset(new tDirtyList);
+	}
+
+private:
+	static const size_t SNoElement = ~(size_t)0;
+
+	// Element of a document being loaded, see GetXMLElements().
+	struct cXMLElement
+	{
+		cXMLElement(const tXMLNode* node, iFactory* factory)
+			: Node(node)
+			, Factory(factory)
+			, Object(nullptr)
+			, Prototype(nullptr)
+			, PrototypeElement(SNoElement)
+			, Level(0)
+			, Referenced(false)
+			, Loaded(false)
+		{
+		}
+
+		bool IsVariant() const { return Prototype || PrototypeElement != SNoElement; }
+
+		const tXMLNode* Node;
+		iFactory* Factory;
+		iBaseObject* Object;
+		iBaseObject* Prototype;		// A registered prototype.
+		size_t PrototypeElement;	// A prototype in the same document.
+		uint Level;					// Prototypes are on lower levels than their variants.
+		bool Referenced;			// Prototype of other elements.
+		bool Loaded;
+		std::exception_ptr Failure;
+	};
+
+	typedef std::vector<cXMLElement> tXMLElements;
+
+	// A top level element of a watched file, see ReloadXML(): where its text is, up to the
+	// next element, and what it loads.
+	struct cXMLSegment
+	{
+		size_t Begin;
+		size_t End;
+		iFactory* Factory;		// Null for unknown types.
+		uint ID;
+		uint PrototypeID;
+		bool HasID;
+		bool IsVariant;
+	};
+
+	typedef std::vector<cXMLSegment> tXMLSegments;
+
+	// A watched file as last loaded.
+	struct cWatchedXML
+	{
+		std::string File;
+		std::string Text;
+		tXMLSegments Segments;
+	};
+
+	// An element a reload loads, with its states before and after.
+	struct cXMLReload
+	{
+		size_t Segment;
+		const tXMLNode* Node;
+		const cXMLSegment* Before;		// The element with its ID last time, if of its type.
+		const tXMLNode* BeforeNode;
+		size_t Index;					// Position among the objects of the file.
+		int State;
+		iBaseObject* Previous;
+		iBaseObject* Current;
+	};
+
+	// Also keeps NextID past the IDs of loaded objects and indexes the object by its ID, so
+	// set the ID first. Of objects sharing an ID the last one registered is found.
+	tHandle RegisterObject(iBaseObject& object, iFactory& factory)
+	{
+		const uint id = object.GetID();
+		if (id >= NextID)
+			NextID = id + 1;
+		if (DirtyTracking)
+		{
+			object.SetDirtyTracking(Dirtied[factory.GetTypeId()].get());
+			object.MarkDirty(SAllDirty);
+		}
+		if (ChangeQueue)
+			object.SetChangeQueue(ChangeQueue.get());
+		tTypeObjects& objects = TypeObjects[factory.GetTypeId()];
+		cEntry entry(&object, &factory);
+		entry.Position = objects.size();
+		const tHandle h = Registery.Insert(entry);
+		objects.push_back(cTypeObject(&object, h));
+		IDs[id] = h;
+		return h;
+	}
+
+	// Room for 'count' more objects in the registry and the ID index.
+	void ReserveObjects(size_t count)
+	{
+		Registery.Reserve(Registery.Size() + count);
+		IDs.reserve(IDs.size() + count);
+	}
+
+	// Registers a copy of 'source', hydrated, under a new ID. See Clone().
+	tHandle RegisterClone(const iBaseObject& source, iFactory& factory)
+	{
+		const uint id = NextID++;
+		iBaseObject* clone = factory.Create(id, "");
+		factory.CopyProperties(*clone, source);
+		clone->SetID(id);
+		clone->SetPrototype(source.GetPrototype());
+		return RegisterObject(*clone, factory);
+	}
+
+	// Erases a registered object and destroys it.
+	void Release(tHandle h)
+	{
+		const cEntry released = *Registery.Find(h);
+		tTypeObjects& objects = TypeObjects[released.Factory->GetTypeId()];
+		objects[released.Position] = objects.back();
+		Registery.Find(objects[released.Position].Handle)->Position = released.Position;
+		objects.pop_back();
+		Registery.Erase(h);
+		auto id = IDs.find(released.Object->GetID());
+		if (id != IDs.end() && id->second == h)
+			IDs.erase(id);
+		if (ChangeQueue && released.Object->HasQueuedChanges())
+			ChangeQueue->Forget(*released.Object);
+		ReleasePrototype(*released.Object);
+		released.Object->SetPrototype(nullptr);
+		released.Factory->Destroy(released.Object);
+	}
+
+	// Links the registered variants of 'prototype', about to be destroyed, to its own
+	// prototype. Walks the registry only for objects that have variants.
+	void ReleasePrototype(const iBaseObject& prototype)
+	{
+		if (!prototype.GetVariantCount())
+			return;
+		for (auto& entry : Registery)
+			if (entry.Object->GetPrototype() == &prototype)
+				entry.Object->SetPrototype(prototype.GetPrototype());
+	}
+
+	// Starts over after an incremental save: no deleted IDs, no changed objects.
+	void ClearDirty();
+
+	// The registered object with ID 'id', null if none.
+	const cEntry* FindByID(uint id, tHandle* handle = nullptr) const
+	{
+		auto it = IDs.find(id);
+		if (it == IDs.end())
+			return nullptr;
+		if (handle)
+			*handle = it->second;
+		return Registery.Find(it->second);
+	}
+
+	static void SaveXMLElement(const cEntry& entry, cXMLWriter& writer);
+
+	// Walk over one property of the objects of a type.
+	struct cColumnCursor
+	{
+		explicit cColumnCursor(size_t property) : Property(property), Offset(0), First(true), Columnar(false) {}
+
+		const size_t Property;
+		ptrdiff_t Offset;
+		bool First;
+		bool Columnar;
+	};
+
+	// Where the cursor's property of 'object' lives. Objects storing their own properties
+	// all have it at the same offset, so only the first one goes through GetProperties();
+	// the others just need hydrating if they are lazy. Rows of columns are bound each time.
+	char* GetColumnValue(iBaseObject& object, cColumnCursor& cursor) const
+	{
+		char* base = reinterpret_cast<char*>(&object);
+		if (cursor.First || cursor.Columnar)
+		{
+			const cPropertySet properties = object.GetProperties();
+			char* value = static_cast<char*>(properties.GetValue(cursor.Property));
+			cursor.First = false;
+			cursor.Columnar = !properties.GetObject();
+			cursor.Offset = value - base;
+			return value;
+		}
+		if (!LazySources.empty())
+			object.Hydrate();
+		return base + cursor.Offset;
+	}
+
+	template <class T_>
+	const cPropertyDescriptor* FindColumn(const char* property, tTypeId type, size_t& index) const
+	{
+		const iFactory* f = FindFactory(type);
+		if (!f)
+			return nullptr;
+		const cPropertySchema& schema = f->GetSchema();
+		for (index = 0; index < schema.GetSize(); ++index)
+			if (strcmp(schema[index].Name, property) == 0)
+				return (schema[index].Type == cPropertyTypeOf<T_>::SType) ? &schema[index] : nullptr;
+		return nullptr;
+	}
+	void ReplayJournal(const char* file);
+	void GetXMLElements(const cXMLDocument& document, tXMLElements& elements, std::vector<uint>& counts);
+	void ReserveXMLElements(const tXMLElements& elements, const std::vector<uint>& counts);
+	void ResolveXMLPrototypes(tXMLElements& elements, std::vector<size_t>& order, std::vector<size_t>& levelEnds);
+	void LoadXMLElement(cXMLElement& element, const tXMLElements& elements) const;
+	// Destroys the loaded objects of elements not registered, unlinking them all first.
+	static void DestroyXMLElements(tXMLElements& elements);
+	void RegisterXMLElements(tXMLElements& elements, const std::vector<size_t>& order);
+	void GetXMLSegments(const std::string& text, const cWatchedXML* last, tXMLSegments& segments, std::vector<size_t>& parsed, std::vector<size_t>& unmatched, const char* file) const;
+	std::unique_ptr<cXMLDocument> ParseXMLSegments(const std::string& text, const tXMLSegments& segments, const std::vector<size_t>& which, std::vector<const tXMLNode*>& nodes, const char* file) const;
+	void SetXMLSegment(cXMLSegment& segment, const tXMLNode& node) const;
+
+	iFactory* FindFactory(tTypeId id) const { return (id < Factories.size()) ? Factories[id].get() : nullptr; }
+	iFactory* FindFactory(const std::string& type) const { return FindFactory(cTypeNames::Find(type)); }
+
+	tRegistry Registery;
+
+	// Indexed by tTypeId.
+	typedef std::vector<rFactory> tFactories;
+	tFactories Factories;
+
+	std::vector<std::unique_ptr<cLazySnapshot>> LazySources;
+
+	// The registered objects of each type, indexed by tTypeId. Deleting one moves the last
+	// of its type into its place.
+	struct cTypeObject
+	{
+		cTypeObject(iBaseObject* object, tHandle handle) : Object(object), Handle(handle) {}
+
+		iBaseObject* Object;
+		tHandle Handle;
+	};
+	typedef std::vector<cTypeObject> tTypeObjects;
+	std::vector<tTypeObjects> TypeObjects;
+
+	uint NextID;
+	std::unordered_map<uint, tHandle> IDs;	// See RegisterObject().
+
+	bool DirtyTracking;
+	std::vector<uint> DeletedIDs;
+	std::vector<std::unique_ptr<tDirtyList>> Dirtied;	// Indexed by tTypeId, see tDirtyList.
+
+	bool XMLBase64Arrays;
+	cLoadDiagnostics* Diagnostics;	// Null for strict loads.
+
+	std::vector<std::unique_ptr<cWatchedXML>> WatchedXML;
+	std::unique_ptr<cFileWatcher> Watcher;
+
+	std::vector<iPropertyObserver*> Observers;
+	std::unique_ptr<cChangeQueue> ChangeQueue;	// Set while there are observers.
+
+	std::unique_ptr<cJournal> Journal;
+	std::string SnapshotFile;
+	std::string JournalFile;
+	cBinaryWriter JournalRecords;
+	std::thread Compactor;
+	std::exception_ptr CompactionFailure;
+};
+
+void cObjectSystem::SaveXMLElement(const cEntry& entry, cXMLWriter& writer)
+{
+	entry.Object->Hydrate();
+	const char* type = entry.Object->GetObjectType();
+	writer.Begin(type);
+	if (const iBaseObject* prototype = entry.Object->GetPrototype())
+	{
+		writer.Attribute("prototype", FormatXMLValue(prototype->GetID()).c_str());
+		entry.Factory->SaveXMLDiff(*entry.Object, *prototype, writer);
+	}
+	else
+	{
+		entry.Factory->SaveXML(*entry.Object, writer);
+	}
+	writer.End(type);
+}
+
+void cObjectSystem::SaveXML(const char* file)
+{
+	cXMLWriter writer(file);
+	writer.SetBase64Arrays(XMLBase64Arrays);
+	for (auto& entry : Registery)
+		SaveXMLElement(entry, writer);
+	writer.Finish();
+}
+
+void cObjectSystem::SaveXML(const char* file, cWorkerPool& pool)
+{
+	// Blocks of objects are formatted into fragments on the workers, then written in registry
+	// order. Going one window of blocks at a time bounds the memory held in fragments.
+	const size_t blockSize = 256;
+	const size_t windowBlocks = pool.GetThreadCount() * 16;
+	std::vector<cXMLWriter> fragments(windowBlocks);
+
+	cXMLWriter writer(file);
+	const size_t count = Registery.Size();
+	for (size_t first = 0; first < count; first += windowBlocks * blockSize)
+	{
+		const size_t blocks = std::min(windowBlocks, (count - first + blockSize - 1) / blockSize);
+		pool.Run(blocks, [&](size_t block)
+		{
+			cXMLWriter& fragment = fragments[block];
+			fragment.Clear();
+			fragment.SetBase64Arrays(XMLBase64Arrays);
+			const size_t begin = first + block * blockSize;
+			const size_t end = std::min(begin + blockSize, count);
+			for (size_t i = begin; i < end; ++i)
+				SaveXMLElement(Registery.begin()[i], fragment);
+		});
+		for (size_t block = 0; block < blocks; ++block)
+			writer.Append(fragments[block]);
+	}
+	writer.Finish();
+}
+
+void cObjectSystem::SaveXMLTree(const char* file)
+{
+	tBoostPTree pt;
+	for (auto& entry : Registery)
+	{
+		tBoostPTree element;
+		entry.Object->Hydrate();
+		entry.Factory->SaveXML(*entry.Object, element);
+		pt.add_child(entry.Object->GetObjectType(), element);
+	}
+	write_xml(file, pt);
+}
+
+void cObjectSystem::GetXMLElements(const cXMLDocument& document, tXMLElements& elements, std::vector<uint>& counts)
+{
+	namespace rapidxml = boost::property_tree::detail::rapidxml;
+
+	counts.assign(Factories.size(), 0);
+	for (const tXMLNode* node = document.GetRoot().first_node(); node; node = node->next_sibling())
+	{
+		if (node->type() != rapidxml::node_element)
+			continue;
+		const tTypeId id = cTypeNames::Find(std::string(node->name(), node->name_size()));
+		if (iFactory* f = FindFactory(id))
+		{
+			elements.push_back(cXMLElement(node, f));
+			++counts[id];
+		}
+	}
+}
+
+void cObjectSystem::ReserveXMLElements(const tXMLElements& elements, const std::vector<uint>& counts)
+{
+	// One registry growth and one pool chunk per type.
+	ReserveObjects(elements.size());
+	for (tTypeId id = 0; id < counts.size(); ++id)
+		if (counts[id])
+			Factories[id]->Reserve(counts[id]);
+}
+
+void cObjectSystem::ResolveXMLPrototypes(tXMLElements& elements, std::vector<size_t>& order, std::vector<size_t>& levelEnds)
+{
+	namespace rapidxml = boost::property_tree::detail::rapidxml;
+	typedef rapidxml::xml_attribute<char> tXMLAttribute;
+
+	bool variants = false;
+	for (auto& element : elements)
+		variants = variants || element.Node->first_attribute("prototype");
+
+	if (variants)
+	{
+		// Elements may refer to later ones, so all IDs are read first.
+		std::unordered_map<uint, size_t> ids;
+		for (size_t i = 0; i < elements.size(); ++i)
+		{
+			if (elements[i].Node->first_node("ID"))
+			{
+				uint id = 0;
+				cXMLNodeDeserializer loader(*elements[i].Node);
+				if (!Diagnostics)
+					loader("ID", id);
+				else if (!loader.Find("ID", id))
+					continue;	// Reported with the element's other properties.
+				ids[id] = i;
+			}
+		}
+
+		// Lenient loads drop the link and load the element as a whole.
+		auto fail = [this](cXMLElement& element, size_t index, const char* what, const tXMLAttribute& attribute)
+		{
+			if (!Diagnostics)
+				BOOST_PROPERTY_TREE_THROW(boost::property_tree::ptree_bad_data(what, std::string(attribute.value(), attribute.value_size())));
+			Diagnostics->Add(index, "prototype", cLoadDiagnostics::eBadPrototype);
+			element.PrototypeElement = SNoElement;
+			element.Prototype = nullptr;
+		};
+
+		for (size_t i = 0; i < elements.size(); ++i)
+		{
+			cXMLElement& element = elements[i];
+			const tXMLAttribute* attribute = element.Node->first_attribute("prototype");
+			if (!attribute)
+				continue;
+			uint id;
+			if (!cIntegerText<uint>::Parse(attribute->value(), attribute->value() + attribute->value_size(), id))
+			{
+				fail(element, i, (std::string("conversion of data to type \"") + typeid(uint).name() + "\" failed").c_str(), *attribute);
+				continue;
+			}
+
+			const iFactory* f;
+			auto it = ids.find(id);
+			if (it != ids.end())
+			{
+				f = elements[it->second].Factory;
+				if (f == element.Factory)
+				{
+					element.PrototypeElement = it->second;
+					elements[it->second].Referenced = true;
+				}
+			}
+			else
+			{
+				const cEntry* entry = FindByID(id);
+				if (!entry)
+				{
+					fail(element, i, "no prototype with this ID", *attribute);
+					continue;
+				}
+				f = entry->Factory;
+				if (f == element.Factory)
+				{
+					entry->Object->Hydrate();
+					element.Prototype = entry->Object;
+				}
+			}
+			if (f != element.Factory)
+				fail(element, i, "prototype of another type", *attribute);
+		}
+
+		// Each chain of prototypes is walked up to a root or an element already on a level,
+		// then numbered down from there.
+		const uint SUnresolved = ~0u;
+		const uint SVisiting = ~0u - 1;
+		for (auto& element : elements)
+			element.Level = SUnresolved;
+		std::vector<size_t> chain;
+		for (size_t i = 0; i < elements.size(); ++i)
+		{
+			chain.clear();
+			for (size_t j = i; j != SNoElement && elements[j].Level == SUnresolved; j = elements[j].PrototypeElement)
+			{
+				elements[j].Level = SVisiting;
+				chain.push_back(j);
+			}
+			if (chain.empty())
+				continue;
+
+			uint level = 0;
+			cXMLElement& top = elements[chain.back()];
+			if (top.PrototypeElement != SNoElement && elements[top.PrototypeElement].Level == SVisiting)
+				fail(top, chain.back(), "prototype cycle", *top.Node->first_attribute("prototype"));
+			if (top.PrototypeElement != SNoElement)
+				level = elements[top.PrototypeElement].Level + 1;
+			for (size_t k = chain.size(); k-- > 0;)
+				elements[chain[k]].Level = level++;
+		}
+	}
+
+	// Counting sort by level, keeping document order within levels.
+	uint levels = 0;
+	for (auto& element : elements)
+		levels = std::max(levels, element.Level + 1);
+	levelEnds.assign(levels, 0);
+	for (auto& element : elements)
+		++levelEnds[element.Level];
+	size_t begin = 0;
+	for (uint level = 0; level < levels; ++level)
+	{
+		const size_t count = levelEnds[level];
+		levelEnds[level] = begin;
+		begin += count;
+	}
+	order.resize(elements.size());
+	for (size_t i = 0; i < elements.size(); ++i)
+		order[levelEnds[elements[i].Level]++] = i;
+}
+
+void cObjectSystem::LoadXMLElement(cXMLElement& element, const tXMLElements& elements) const
+{
+	const cLoadScope scope = Diagnostics ? cLoadScope(*Diagnostics, &element - elements.data()) : cLoadScope();
+	iBaseObject* prototype = (element.PrototypeElement != SNoElement) ? elements[element.PrototypeElement].Object : element.Prototype;
+	if (prototype)
+	{
+		element.Factory->CopyProperties(*element.Object, *prototype);
+		element.Factory->LoadXMLDelta(*element.Object, *element.Node, scope);
+		element.Object->SetPrototype(prototype);
+	}
+	else
+	{
+		element.Factory->LoadXML(*element.Object, *element.Node, scope);
+	}
+	element.Loaded = true;
+}
+
+void cObjectSystem::DestroyXMLElements(tXMLElements& elements)
+{
+	for (auto& element : elements)
+		if (element.Object)
+			element.Object->SetPrototype(nullptr);
+	for (auto& element : elements)
+	{
+		if (element.Object)
+			element.Factory->Destroy(element.Object);
+		element.Object = nullptr;
+	}
+}
+
+void cObjectSystem::RegisterXMLElements(tXMLElements& elements, const std::vector<size_t>& order)
+{
+	// Variants without an ID of their own get new ones past all loaded IDs before they are
+	// registered, and indexed, under them.
+	size_t count = 0;
+	for (; count < elements.size() && elements[count].Loaded; ++count)
+		if (!elements[count].IsVariant() || elements[count].Node->first_node("ID"))
+			NextID = std::max(NextID, elements[count].Object->GetID() + 1);
+	for (size_t i = 0; i < count; ++i)
+		if (elements[i].IsVariant() && !elements[i].Node->first_node("ID"))
+			elements[i].Object->SetID(NextID++);
+	for (size_t i = 0; i < count; ++i)
+		RegisterObject(*elements[i].Object, *elements[i].Factory);
+	if (count == elements.size())
+		return;
+
+	// Variants go before their prototypes, so registered ones end up linked to what stays.
+	for (size_t k = order.size(); k-- > 0;)
+	{
+		cXMLElement& element = elements[order[k]];
+		if (order[k] < count)
+			continue;
+		if (element.Referenced)
+			ReleasePrototype(*element.Object);
+		element.Object->SetPrototype(nullptr);
+		element.Factory->Destroy(element.Object);
+	}
+	for (auto& element : elements)
+		if (element.Failure)
+			std::rethrow_exception(element.Failure);
+}
+
+void cObjectSystem::LoadXML(const char* file)
+{
+	cXMLDocument document(file);
+	tXMLElements elements;
+	std::vector<uint> counts;
+	std::vector<size_t> order;
+	std::vector<size_t> levelEnds;
+	const size_t diagnostics = Diagnostics ? Diagnostics->Get().size() : 0;
+	GetXMLElements(document, elements, counts);
+	ResolveXMLPrototypes(elements, order, levelEnds);
+	ReserveXMLElements(elements, counts);
+
+	// Prototypes are loaded before their variants, the objects registered in document order.
+	// Everything before the first failing element stays registered.
+	for (auto& element : elements)
+		element.Object = element.Factory->Create(0, "");
+	for (size_t i : order)
+	{
+		try
+		{
+			LoadXMLElement(elements[i], elements);
+		}
+		catch (...)
+		{
+			elements[i].Failure = std::current_exception();
+			break;
+		}
+	}
+	if (Diagnostics)
+		Diagnostics->Sort(diagnostics);
+	RegisterXMLElements(elements, order);
+}
+
+void cObjectSystem::LoadXML(const char* file, cWorkerPool& pool)
+{
+	cXMLDocument document(file);
+	tXMLElements elements;
+	std::vector<uint> counts;
+	std::vector<size_t> order;
+	std::vector<size_t> levelEnds;
+	const size_t diagnostics = Diagnostics ? Diagnostics->Get().size() : 0;
+	GetXMLElements(document, elements, counts);
+	ResolveXMLPrototypes(elements, order, levelEnds);
+	ReserveXMLElements(elements, counts);
+
+	// The pools are not thread safe: objects are created up front, loaded on the workers one
+	// level of prototypes at a time and registered like the serial path does.
+	for (auto& element : elements)
+		element.Object = element.Factory->Create(0, "");
+	for (size_t level = 0, begin = 0; level < levelEnds.size(); begin = levelEnds[level++])
+	{
+		pool.Run(levelEnds[level] - begin, [&](size_t i)
+		{
+			cXMLElement& element = elements[order[begin + i]];
+			try
+			{
+				LoadXMLElement(element, elements);
+			}
+			catch (...)
+			{
+				element.Failure = std::current_exception();
+			}
+		});
+
+		bool failed = false;
+		for (size_t i = begin; i < levelEnds[level]; ++i)
+			failed = failed || elements[order[i]].Failure;
+		if (failed)
+			break;
+	}
+	if (Diagnostics)
+		Diagnostics->Sort(diagnostics);
+	RegisterXMLElements(elements, order);
+}
+
+bool cObjectSystem::SetPrototype(tHandle object, tHandle prototype)
+{
+	const cEntry* entry = Registery.Find(object);
+	if (!entry)
+		return false;
+
+	iBaseObject* base = nullptr;
+	if (!prototype.IsNull())
+	{
+		const cEntry* p = Registery.Find(prototype);
+		if (!p || p->Factory != entry->Factory)
+			return false;
+		for (const iBaseObject* o = p->Object; o; o = o->GetPrototype())
+			if (o == entry->Object)
+				return false;
+		base = p->Object;
+		// Variants are saved against it, possibly from several threads.
+		base->Hydrate();
+	}
+	entry->Object->SetPrototype(base);
+	return true;
+}
+
+cObjectSystem::tHandle cObjectSystem::Instantiate(tHandle prototype)
+{
+	const cEntry* entry = Registery.Find(prototype);
+	if (!entry)
+		return tHandle();
+
+	iFactory* f = entry->Factory;
+	iBaseObject* base = entry->Object;
+	base->Hydrate();
+	const uint id = NextID++;
+	iBaseObject* object = f->Create(id, "");
+	f->CopyProperties(*object, *base);
+	object->SetID(id);
+	object->SetPrototype(base);
+	return RegisterObject(*object, *f);
+}
+
+cObjectSystem::tHandle cObjectSystem::Clone(tHandle object)
+{
+	const cEntry* entry = Registery.Find(object);
+	if (!entry)
+		return tHandle();
+
+	iBaseObject* source = entry->Object;
+	source->Hydrate();
+	return RegisterClone(*source, *entry->Factory);
+}
+
+void cObjectSystem::CloneN(tHandle object, size_t count, std::vector<tHandle>* handles)
+{
+	const cEntry* entry = Registery.Find(object);
+	if (!entry)
+		return;
+
+	// The entry moves when the registry grows.
+	iFactory* f = entry->Factory;
+	iBaseObject* source = entry->Object;
+	source->Hydrate();
+	ReserveObjects(count);
+	f->Reserve(count);
+	if (handles)
+		handles->reserve(handles->size() + count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		tHandle h = RegisterClone(*source, *f);
+		if (handles)
+			handles->push_back(h);
+	}
+}
+
+void cObjectSystem::LoadXMLTree(const char* file)
+{
+	tBoostPTree pt;
+	read_xml(file, pt);
+
+	// Reserve everything up front: one registry growth and one pool chunk per type.
+	std::vector<size_t> counts(Factories.size(), 0);
+	size_t total = 0;
+	for (auto& element : pt.get_child(""))
+	{
+		const tTypeId id = cTypeNames::Find(element.first);
+		if (FindFactory(id))
+		{
+			++counts[id];
+			++total;
+		}
+	}
+	ReserveObjects(total);
+	for (tTypeId id = 0; id < counts.size(); ++id)
+		if (counts[id])
+			Factories[id]->Reserve(counts[id]);
+
+	size_t index = 0;
+	for (auto& element : pt.get_child(""))
+	{
+		if (iFactory* f = FindFactory(element.first))
+		{
+			iBaseObject* object = f->Create(0, "");
+			try
+			{
+				f->LoadXML(*object, element.second, Diagnostics ? cLoadScope(*Diagnostics, index++) : cLoadScope());
+			}
+			catch (...)
+			{
+				f->Destroy(object);
+				throw;
+			}
+			RegisterObject(*object, *f);
+		}
+	}
+}
+
+// Splits 'text' into segments. One with the same text as the next segment of 'last', or
+// as one a few after, the others having gone, keeps what 'last' knew about it; the others
+// are only found, their indices added to 'parsed' for SetXMLSegment(). Segments of 'last'
+// not kept go to 'unmatched'. Only the text of those is scanned, the rest just compared.
+void cObjectSystem::GetXMLSegments(const std::string& text, const cWatchedXML* last, tXMLSegments& segments,
+	std::vector<size_t>& parsed, std::vector<size_t>& unmatched, const char* file) const
+{
+	namespace xml = boost::property_tree::xml_parser;
+
+	static const size_t SLookahead = 16;	// Removed elements in a row still found as such.
+
+	const char* begin = text.data();
+	const char* end = begin + text.size();
+	const char* p = cXMLDocument::FindElement(begin, end);
+	auto malformed = [&]()
+	{
+		// Parse errors tell where.
+		cXMLDocument document(text, file);
+		BOOST_PROPERTY_TREE_THROW(xml::xml_parser_error("unexpected end of data", file, 0));
+	};
+	if (!p)
+		malformed();
+	const size_t lastSize = last ? last->Segments.size() : 0;
+	const size_t header = p - begin;
+	if (!last || header != (lastSize ? last->Segments[0].Begin : last->Text.size()) || memcmp(begin, last->Text.data(), header) != 0)
+		cXMLDocument document(text.substr(0, header), file);
+
+	auto same = [&](size_t k, const char* from, const char* to)
+	{
+		const cXMLSegment& segment = last->Segments[k];
+		return segment.End - segment.Begin == size_t(to - from) && memcmp(from, last->Text.data() + segment.Begin, to - from) == 0;
+	};
+	size_t k = 0;
+	while (p != end)
+	{
+		// An element ends where its text says, so one starting with the next segment's text is
+		// that one; what follows it still has to be the next element.
+		if (k < lastSize)
+		{
+			const cXMLSegment& segment = last->Segments[k];
+			const size_t size = segment.End - segment.Begin;
+			if (size <= size_t(end - p) && memcmp(p, last->Text.data() + segment.Begin, size) == 0 &&
+				cXMLDocument::FindElement(p + size, end) == p + size)
+			{
+				segments.push_back(segment);
+				segments.back().Begin = p - begin;
+				segments.back().End = p - begin + size;
+				p += size;
+				++k;
+				continue;
+			}
+		}
+
+		const char* element = cXMLDocument::SkipElement(p, end);
+		const char* next = element ? cXMLDocument::FindElement(element, end) : nullptr;
+		if (!next)
+			malformed();
+		size_t skipped = 1;
+		while (skipped <= SLookahead && k + skipped < lastSize && !same(k + skipped, p, next))
+			++skipped;
+		cXMLSegment segment;
+		if (skipped <= SLookahead && k + skipped < lastSize)
+		{
+			for (; skipped > 0; --skipped)
+				unmatched.push_back(k++);
+			segment = last->Segments[k++];
+		}
+		else
+		{
+			segment.Factory = nullptr;
+			segment.ID = segment.PrototypeID = 0;
+			segment.HasID = segment.IsVariant = false;
+			parsed.push_back(segments.size());
+		}
+		segment.Begin = p - begin;
+		segment.End = next - begin;
+		segments.push_back(segment);
+		p = next;
+	}
+	for (; k < lastSize; ++k)
+		unmatched.push_back(k);
+}
+
+// Parses the elements of the segments 'which' of 'text' together, into 'nodes' in order.
+// Null for none.
+std::unique_ptr<cXMLDocument> cObjectSystem::ParseXMLSegments(const std::string& text, const tXMLSegments& segments,
+	const std::vector<size_t>& which, std::vector<const tXMLNode*>& nodes, const char* file) const
+{
+	namespace xml = boost::property_tree::xml_parser;
+	namespace rapidxml = boost::property_tree::detail::rapidxml;
+
+	std::unique_ptr<cXMLDocument> document;
+	if (which.empty())
+		return document;
+	if (which.size() == segments.size() && std::is_sorted(which.begin(), which.end()))
+	{
+		document.reset(new cXMLDocument(text, file));
+	}
+	else
+	{
+		std::string fragment;
+		for (size_t i : which)
+			fragment.append(text, segments[i].Begin, segments[i].End - segments[i].Begin);
+		try
+		{
+			document.reset(new cXMLDocument(fragment, file));
+		}
+		catch (xml::xml_parser_error&)
+		{
+			// Parse errors tell where in the file.
+			cXMLDocument whole(text, file);
+			throw;
+		}
+	}
+	const size_t first = nodes.size();
+	for (const tXMLNode* node = document->GetRoot().first_node(); node; node = node->next_sibling())
+		if (node->type() == rapidxml::node_element)
+			nodes.push_back(node);
+	if (nodes.size() - first != which.size())
+		BOOST_PROPERTY_TREE_THROW(xml::xml_parser_error("unexpected top level element", file, 0));
+	return document;
+}
+
+void cObjectSystem::SetXMLSegment(cXMLSegment& segment, const tXMLNode& node) const
+{
+	namespace rapidxml = boost::property_tree::detail::rapidxml;
+	typedef rapidxml::xml_attribute<char> tXMLAttribute;
+
+	segment.Factory = FindFactory(std::string(node.name(), node.name_size()));
+	cXMLNodeDeserializer loader(node);
+	segment.HasID = loader.Find("ID", segment.ID);
+	const tXMLAttribute* attribute = node.first_attribute("prototype");
+	segment.IsVariant = attribute && cIntegerText<uint>::Parse(attribute->value(), attribute->value() + attribute->value_size(), segment.PrototypeID);
+}
+
+void cObjectSystem::WatchXML(const char* file)
+{
+	std::unique_ptr<cWatchedXML> watched(new cWatchedXML);
+	watched->File = file;
+	cXMLDocument::Read(file, watched->Text);
+	std::vector<size_t> parsed;
+	std::vector<size_t> unmatched;
+	GetXMLSegments(watched->Text, nullptr, watched->Segments, parsed, unmatched, file);
+	std::vector<const tXMLNode*> nodes;
+	std::unique_ptr<cXMLDocument> document = ParseXMLSegments(watched->Text, watched->Segments, parsed, nodes, file);
+	for (size_t k = 0; k < parsed.size(); ++k)
+		SetXMLSegment(watched->Segments[parsed[k]], *nodes[k]);
+
+	if (!Watcher)
+		Watcher.reset(new cFileWatcher());
+	Watcher->Add(file);
+	for (auto& w : WatchedXML)
+	{
+		if (w->File == file)
+		{
+			w.swap(watched);
+			return;
+		}
+	}
+	WatchedXML.push_back(std::move(watched));
+}
+
+size_t cObjectSystem::PollXML()
+{
+	if (!Watcher)
+		return 0;
+	std::vector<std::string> changed;
+	Watcher->Poll(changed);
+
+	// Files are reloaded independently; the first failure is rethrown after all.
+	size_t count = 0;
+	std::exception_ptr failure;
+	for (auto& file : changed)
+	{
+		try
+		{
+			count += ReloadXML(file.c_str());
+		}
+		catch (...)
+		{
+			if (!failure)
+				failure = std::current_exception();
+		}
+	}
+	if (failure)
+		std::rethrow_exception(failure);
+	return count;
+}
+
+size_t cObjectSystem::ReloadXML(const char* file)
+{
+	enum { eUndecided = 0, eVisiting, eDecided };
+
+	cWatchedXML* watched = nullptr;
+	for (auto& w : WatchedXML)
+		if (w->File == file)
+			watched = w.get();
+	if (!watched)
+		BOOST_PROPERTY_TREE_THROW(boost::property_tree::file_parser_error("file is not watched", file, 0));
+
+	std::string text;
+	cXMLDocument::Read(file, text);
+	if (text == watched->Text)
+		return 0;
+
+	// Only edited and new elements are parsed.
+	tXMLSegments segments;
+	segments.reserve(watched->Segments.size());
+	std::vector<size_t> parsed;
+	std::vector<size_t> unmatched;
+	GetXMLSegments(text, watched, segments, parsed, unmatched, file);
+	std::vector<const tXMLNode*> nodes;
+	std::vector<std::unique_ptr<cXMLDocument>> documents;
+	documents.push_back(ParseXMLSegments(text, segments, parsed, nodes, file));
+	for (size_t k = 0; k < parsed.size(); ++k)
+		SetXMLSegment(segments[parsed[k]], *nodes[k]);
+
+	std::unordered_map<uint, const cXMLSegment*> before;
+	for (size_t k : unmatched)
+	{
+		const cXMLSegment& segment = watched->Segments[k];
+		if (segment.Factory && segment.HasID)
+			before.insert(std::make_pair(segment.ID, &segment));
+	}
+
+	// What is reloaded, by ID: those elements, then variants of reloaded elements until there
+	// are no more. Those have the same text as before, and loaded it.
+	std::vector<cXMLReload> reloads;
+	std::unordered_map<uint, size_t> ids;
+	auto add = [&](size_t i, const tXMLNode* node)
+	{
+		const cXMLSegment& segment = segments[i];
+		if (!segment.Factory || !segment.HasID || !ids.insert(std::make_pair(segment.ID, reloads.size())).second)
+			return;
+		cXMLReload reload;
+		reload.Segment = i;
+		reload.Node = node;
+		reload.Before = node ? nullptr : &segment;
+		reload.BeforeNode = nullptr;
+		reload.Index = 0;
+		reload.State = eUndecided;
+		reload.Previous = reload.Current = nullptr;
+		auto it = node ? before.find(segment.ID) : before.end();
+		if (it != before.end() && it->second->Factory == segment.Factory)
+			reload.Before = it->second;
+		reloads.push_back(reload);
+	};
+	for (size_t k = 0; k < parsed.size(); ++k)
+		add(parsed[k], nodes[k]);
+	const size_t edited = reloads.size();
+	for (size_t size = 0; size != reloads.size();)
+	{
+		size = reloads.size();
+		for (size_t i = 0; i < segments.size(); ++i)
+			if (segments[i].IsVariant && ids.count(segments[i].PrototypeID) && !ids.count(segments[i].ID))
+				add(i, nullptr);
+	}
+	if (reloads.empty())
+	{
+		watched->Text.swap(text);
+		watched->Segments.swap(segments);
+		return 0;
+	}
+
+	std::vector<size_t> which;
+	for (size_t r = edited; r < reloads.size(); ++r)
+		which.push_back(reloads[r].Segment);
+	nodes.clear();
+	documents.push_back(ParseXMLSegments(text, segments, which, nodes, file));
+	for (size_t r = edited; r < reloads.size(); ++r)
+		reloads[r].Node = reloads[r].BeforeNode = nodes[r - edited];
+	which.clear();
+	for (auto& reload : reloads)
+		if (reload.Before && !reload.BeforeNode)
+			which.push_back(reload.Before - watched->Segments.data());
+	nodes.clear();
+	documents.push_back(ParseXMLSegments(watched->Text, watched->Segments, which, nodes, file));
+	size_t n = 0;
+	for (auto& reload : reloads)
+		if (reload.Before && !reload.BeforeNode)
+			reload.BeforeNode = nodes[n++];
+
+	// Positions for diagnostics, counted the way LoadXML() counts them.
+	std::vector<std::pair<size_t, size_t>> positions;
+	for (size_t r = 0; r < reloads.size(); ++r)
+		positions.push_back(std::make_pair(reloads[r].Segment, r));
+	std::sort(positions.begin(), positions.end());
+	size_t index = 0;
+	for (size_t i = 0, k = 0; k < positions.size(); ++i)
+	{
+		if (i == positions[k].first)
+			reloads[positions[k++].second].Index = index;
+		if (segments[i].Factory)
+			++index;
+	}
+
+	// Prototypes first: each chain of prototypes is walked up to a root or a decided element,
+	// then decided down.
+	std::vector<size_t> order;
+	std::vector<size_t> chain;
+	for (size_t r = 0; r < reloads.size(); ++r)
+	{
+		chain.clear();
+		size_t j = r;
+		while (j != SNoElement && reloads[j].State == eUndecided)
+		{
+			reloads[j].State = eVisiting;
+			chain.push_back(j);
+			const cXMLSegment& segment = segments[reloads[j].Segment];
+			auto it = segment.IsVariant ? ids.find(segment.PrototypeID) : ids.end();
+			j = (it != ids.end()) ? it->second : SNoElement;
+		}
+		for (size_t k = chain.size(); k-- > 0;)
+		{
+			reloads[chain[k]].State = eDecided;
+			order.push_back(chain[k]);
+		}
+	}
+
+	// Live object of an element or prototype, loaded if lazy.
+	auto live = [&](uint id, const iFactory* f) -> iBaseObject*
+	{
+		const cEntry* entry = FindByID(id);
+		if (!entry || entry->Factory != f)
+			return nullptr;
+		entry->Object->Hydrate();
+		return entry->Object;
+	};
+
+	// A state of an element. Variants start from the same state of their prototype when this
+	// reload loads it, from the live prototype otherwise; other elements from 'start'.
+	cLoadDiagnostics reported;
+	auto load = [&](const cXMLReload& reload, bool current, const iBaseObject* start) -> iBaseObject*
+	{
+		const cXMLSegment& segment = current ? segments[reload.Segment] : *reload.Before;
+		const tXMLNode& node = current ? *reload.Node : *reload.BeforeNode;
+		iBaseObject* prototype = nullptr;
+		if (segment.IsVariant)
+		{
+			auto it = ids.find(segment.PrototypeID);
+			if (it != ids.end())
+				prototype = current ? reloads[it->second].Current : reloads[it->second].Previous;
+			if (!prototype)
+				prototype = live(segment.PrototypeID, segment.Factory);
+		}
+		// The previous state has loaded before and has been reported then, if at all.
+		const cLoadScope scope = !current ? cLoadScope(reported, reload.Index) : Diagnostics ? cLoadScope(*Diagnostics, reload.Index) : cLoadScope();
+		iBaseObject* object = segment.Factory->Create(0, "");
+		try
+		{
+			if (prototype)
+			{
+				segment.Factory->CopyProperties(*object, *prototype);
+				segment.Factory->LoadXMLDelta(*object, node, scope);
+			}
+			else
+			{
+				if (start)
+					segment.Factory->CopyProperties(*object, *start);
+				segment.Factory->LoadXML(*object, node, scope);
+			}
+		}
+		catch (...)
+		{
+			segment.Factory->Destroy(object);
+			throw;
+		}
+		return object;
+	};
+	auto destroy = [&]()
+	{
+		for (size_t k = order.size(); k-- > 0;)
+		{
+			cXMLReload& reload = reloads[order[k]];
+			iFactory* f = segments[reload.Segment].Factory;
+			if (reload.Current)
+				f->Destroy(reload.Current);
+			if (reload.Previous)
+				f->Destroy(reload.Previous);
+			reload.Current = reload.Previous = nullptr;
+		}
+	};
+
+	try
+	{
+		for (size_t r : order)
+		{
+			cXMLReload& reload = reloads[r];
+			if (reload.Before)
+				reload.Previous = load(reload, false, nullptr);
+			// Properties a lenient load cannot read keep their previous values.
+			reload.Current = load(reload, true, Diagnostics ? reload.Previous : nullptr);
+		}
+	}
+	catch (...)
+	{
+		destroy();
+		throw;
+	}
+
+	// Only now the live objects change.
+	size_t count = 0;
+	for (size_t r : order)
+	{
+		cXMLReload& reload = reloads[r];
+		const cXMLSegment& segment = segments[reload.Segment];
+		tHandle h;
+		const cEntry* entry = FindByID(segment.ID, &h);
+		if (entry && entry->Factory != segment.Factory)
+			continue;
+		if (entry)
+		{
+			iBaseObject* previous = reload.Previous ? reload.Previous : entry->Object;
+			count += SetChangedProperties(entry->Object->GetProperties(), previous->GetProperties(), reload.Current->GetProperties());
+		}
+		else
+		{
+			count += segment.Factory->GetSchema().GetSize();
+			h = RegisterObject(*reload.Current, *segment.Factory);
+			reload.Current = nullptr;
+		}
+		tHandle prototype;
+		if (segment.IsVariant && live(segment.PrototypeID, segment.Factory))
+			FindByID(segment.PrototypeID, &prototype);
+		SetPrototype(h, prototype);
+	}
+	destroy();
+
+	watched->Text.swap(text);
+	watched->Segments.swap(segments);
+	return count;
+}
+
+void cObjectSystem::SaveBinary(const char* file)
+{
+	std::vector<uint> counts(Factories.size(), 0);
+	for (auto& entry : Registery)
+		++counts[entry.Factory->GetTypeId()];
+
+	cBinarySnapshot snapshot;
+	std::vector<uint> types(Factories.size(), 0);
+	for (tTypeId id = 0; id < counts.size(); ++id)
+		if (counts[id])
+			types[id] = snapshot.AddType(Factories[id]->GetType(), Factories[id]->GetSchema(), counts[id]);
+
+	cBinaryWriter writer(file);
+	snapshot.Write(writer);
+	for (auto& entry : Registery)
+	{
+		snapshot.BeginObject(writer, types[entry.Factory->GetTypeId()]);
+		cBinarySnapshot::WriteValues(writer, entry.Object->GetProperties());
+	}
+	snapshot.WriteIndex(writer);
+	writer.Finish();
+}
+
+void cObjectSystem::LoadBinary(const char* file)
+{
+	cMappedFile mapping(file);
+	cBinaryReader reader(mapping.GetData(), mapping.GetSize(), file);
+	cBinarySnapshot snapshot;
+	snapshot.Read(reader);
+
+	std::vector<iFactory*> factories;
+	std::vector<cBinaryLoadPlan> plans;
+	size_t total = 0;
+	for (auto& type : snapshot.GetTypes())
+	{
+		iFactory* f = FindFactory(type.Name);
+		factories.push_back(f);
+		plans.push_back(cBinaryLoadPlan(snapshot, type, f ? &f->GetSchema() : nullptr));
+		if (f)
+		{
+			f->Reserve(type.Objects);
+			total += type.Objects;
+		}
+	}
+	ReserveObjects(total);
+
+	while (!reader.IsEnd())
+	{
+		const uint type = reader.GetUInt();
+		if (type >= plans.size())
+			reader.Fail("corrupted object type");
+
+		iFactory* f = factories[type];
+		if (!f)
+		{
+			plans[type].Load(reader, nullptr);
+			continue;
+		}
+
+		iBaseObject* object = f->Create(0, "");
+		try
+		{
+			plans[type].Load(reader, object->GetProperties());
+		}
+		catch (...)
+		{
+			f->Destroy(object);
+			throw;
+		}
+		RegisterObject(*object, *f);
+	}
+}
+
+void cObjectSystem::LoadBinaryLazy(const char* file)
+{
+	std::unique_ptr<cLazySnapshot> source(new cLazySnapshot(file));
+	const cBinarySnapshot& snapshot = source->GetSnapshot();
+
+	std::vector<iFactory*> factories;
+	size_t total = 0;
+	for (auto& type : snapshot.GetTypes())
+	{
+		iFactory* f = FindFactory(type.Name);
+		factories.push_back(f);
+		source->AddPlan(f ? &f->GetSchema() : nullptr);
+		if (f)
+		{
+			f->Reserve(type.Objects);
+			total += type.Objects;
+		}
+	}
+	ReserveObjects(total);
+
+	for (size_t i = 0; i < snapshot.GetObjectCount(); ++i)
+	{
+		if (iFactory* f = factories[snapshot.GetObjectType(i)])
+		{
+			uint id = 0;
+			source->GetID(i, id);
+			iBaseObject* object = f->Create(id, "");
+			object->SetPropertySource(*source, (uint)i);
+			RegisterObject(*object, *f);
+		}
+	}
+	LazySources.push_back(std::move(source));
+}
+
+void cObjectSystem::SetDirtyTracking(bool enable)
+{
+	DirtyTracking = enable;
+	DeletedIDs.clear();
+	for (auto& entry : Registery)
+		entry.Object->SetDirtyTracking(enable ? Dirtied[entry.Factory->GetTypeId()].get() : nullptr);
+	for (auto& dirtied : Dirtied)
+		if (dirtied)
+			dirtied->clear();
+}
+
+void cObjectSystem::ClearDirty()
+{
+	DeletedIDs.clear();
+	for (auto& dirtied : Dirtied)
+	{
+		if (!dirtied)
+			continue;
+		for (cChangeFlags* changes : *dirtied)
+			if (changes)
+				changes->Dirty = 0;
+		dirtied->clear();
+	}
+}
+
+void cObjectSystem::AddObserver(iPropertyObserver& observer)
+{
+	if (std::find(Observers.begin(), Observers.end(), &observer) != Observers.end())
+		return;
+	Observers.push_back(&observer);
+	if (ChangeQueue)
+		return;
+	ChangeQueue.reset(new cChangeQueue);
+	for (auto& entry : Registery)
+		entry.Object->SetChangeQueue(ChangeQueue.get());
+}
+
+void cObjectSystem::RemoveObserver(iPropertyObserver& observer)
+{
+	auto it = std::find(Observers.begin(), Observers.end(), &observer);
+	if (it == Observers.end())
+		return;
+	Observers.erase(it);
+	if (!Observers.empty())
+		return;
+	for (auto& entry : Registery)
+		entry.Object->SetChangeQueue(nullptr);
+	ChangeQueue.reset();
+}
+
+void cObjectSystem::SaveDelta(const char* file)
+{
+	cXMLWriter writer(file);
+	writer.SetBase64Arrays(XMLBase64Arrays);
+	writer.Begin("Delta");
+	for (uint id : DeletedIDs)
+	{
+		writer.Begin("Deleted");
+		writer.Value("ID", FormatXMLValue(id));
+		writer.End("Deleted");
+	}
+
+	cStreamingPropertySerializer saver(writer);
+	for (auto& dirtied : Dirtied)
+	{
+		if (!dirtied)
+			continue;
+		for (cChangeFlags* changes : *dirtied)
+		{
+			if (!changes)
+				continue;
+
+			iBaseObject* object = changes->Object;
+			const tDirtyMask dirty = changes->Dirty;
+			const char* type = object->GetObjectType();
+			const cPropertySet properties = object->GetProperties();
+			writer.Begin(type);
+			writer.Value("ID", FormatXMLValue(object->GetID()));
+			size_t i = 0;
+			for (cProperty p : properties)
+				if ((dirty & GetDirtyBit(i++)) && strcmp(p.GetName(), "ID") != 0)
+					p.Accept(saver);
+			writer.End(type);
+		}
+	}
+	writer.End("Delta");
+	writer.Finish();
+
+	ClearDirty();
+}
+
+void cObjectSystem::ApplyDelta(const char* file)
+{
+	namespace rapidxml = boost::property_tree::detail::rapidxml;
+
+	cXMLDocument document(file);
+	const tXMLNode* delta = document.GetRoot().first_node("Delta");
+	if (!delta)
+		BOOST_PROPERTY_TREE_THROW(boost::property_tree::ptree_bad_path("No such node", tBoostPTree::path_type("Delta")));
 
-struct Vector3
+	for (const tXMLNode* node = delta->first_node(); node; node = node->next_sibling())
+	{
+		if (node->type() != rapidxml::node_element)
+			continue;
+
+		uint id = 0;
+		cXMLNodeDeserializer loader(*node);
+		loader("ID", id);
+		tHandle h;
+		const cEntry* entry = FindByID(id, &h);
+
+		const std::string name(node->name(), node->name_size());
+		if (name == "Deleted")
+		{
+			if (entry)
+				Release(h);
+		}
+		else if (entry)
+		{
+			entry->Object->Hydrate();
+			entry->Factory->LoadXMLDelta(*entry->Object, *node, cLoadScope());
+		}
+		else if (iFactory* f = FindFactory(name))
+		{
+			iBaseObject* object = f->Create(0, "");
+			try
+			{
+				f->LoadXML(*object, *node, cLoadScope());
+			}
+			catch (...)
+			{
+				f->Destroy(object);
+				throw;
+			}
+			RegisterObject(*object, *f);
+			object->ClearDirty();
+		}
+	}
+}
+
+void cObjectSystem::ReplayJournal(const char* file)
 {
-	Vector3() : X(0.f), Y(0.f), Z(0.f) {}
-	Vector3(float x, float y, float z) : X(x), Y(y), Z(z) {}
+	std::string type;
+	cJournal::Read(file, [&](cBinaryReader& r)
+	{
+		while (!r.IsEnd())
+		{
+			const uint record = r.GetUInt();
+			if (record == cJournal::eDelete)
+			{
+				tHandle h;
+				if (FindByID(r.GetUInt(), &h))
+					Release(h);
+			}
+			else if (record == cJournal::eObject)
+			{
+				r.GetString(type);
+				const uint id = r.GetUInt();
+				const tDirtyMask dirty = r.GetUInt64();
 
-	float X;
-	float Y;
-	float Z;
-};
+				const cEntry* entry = FindByID(id);
+				iFactory* f = entry ? entry->Factory : FindFactory(type);
+				if (!f)
+					r.Fail("unknown object type in journal");
+				iBaseObject* object = entry ? entry->Object : f->Create(0, "");
 
-typedef boost::property_tree::ptree tBoostPTree;
+				try
+				{
+					size_t i = 0;
+					for (cProperty p : object->GetProperties())
+						if (dirty & GetDirtyBit(i++))
+							cBinarySnapshot::ReadValue(r, p);
+				}
+				catch (...)
+				{
+					if (!entry)
+						f->Destroy(object);
+					throw;
+				}
+				if (!entry)
+					RegisterObject(*object, *f);
+			}
+			else
+			{
+				r.Fail("corrupted journal record");
+			}
+		}
+	});
+}
 
-struct iPropertyIterator
+void cObjectSystem::OpenJournal(const char* snapshotFile, const char* journalFile)
 {
-	virtual ~iPropertyIterator() {}
+	CloseJournal();
+	SnapshotFile = snapshotFile;
+	JournalFile = journalFile;
 
-	virtual bool Next() = 0;
-	virtual class cProperty& Get() = 0;
-};
+	// A journal left over from an interrupted compaction may already be part of the snapshot;
+	// replaying it again does no harm as records hold absolute values.
+	const std::string previous = JournalFile + ".old";
+	if (FileExists(snapshotFile))
+		LoadBinary(snapshotFile);
+	if (FileExists(previous.c_str()))
+		ReplayJournal(previous.c_str());
+	if (FileExists(journalFile))
+		ReplayJournal(journalFile);
 
-struct iIterableProperties
+	// Starting over from a fresh snapshot also drops a torn tail of the journal. The journals
+	// go only once the snapshot holding them is on the disk.
+	const std::string temporary = SnapshotFile + ".tmp";
+	SaveBinary(temporary.c_str());
+	MoveFileDurably(temporary.c_str(), snapshotFile);
+	remove(previous.c_str());
+	Journal.reset(new cJournal(journalFile));
+	SetDirtyTracking(true);
+}
+
+void cObjectSystem::CommitJournal()
 {
-	typedef std::unique_ptr<iPropertyIterator> rUniquePIterator;
+	assert(Journal);
+	JournalRecords.Clear();
+	for (uint id : DeletedIDs)
+	{
+		JournalRecords.PutUInt(cJournal::eDelete);
+		JournalRecords.PutUInt(id);
+	}
+	for (tTypeId type = 0; type < Dirtied.size(); ++type)
+	{
+		if (!Dirtied[type])
+			continue;
+		for (cChangeFlags* changes : *Dirtied[type])
+		{
+			if (!changes)
+				continue;
 
-	virtual ~iIterableProperties() {}
+			iBaseObject* object = changes->Object;
+			const tDirtyMask dirty = changes->Dirty;
+			JournalRecords.PutUInt(cJournal::eObject);
+			JournalRecords.PutString(Factories[type]->GetType());
+			JournalRecords.PutUInt(object->GetID());
+			JournalRecords.PutUInt64(dirty);
+			size_t i = 0;
+			for (cProperty p : object->GetProperties())
+				if (dirty & GetDirtyBit(i++))
+					cBinarySnapshot::WriteValue(JournalRecords, p);
+		}
+	}
+	Journal->Append(JournalRecords.GetBuffer());
 
-	virtual rUniquePIterator CreateIterator() const = 0;
-};
+	ClearDirty();
+}
 
-class cProperty
+void cObjectSystem::CompactJournal()
 {
-public:
-	enum ePropertyType
+	CommitJournal();
+	WaitForCompaction();
+
+	// After a failed compaction the previous journal is still around; fold it first and
+	// leave the current one for the next round.
+	const std::string previous = JournalFile + ".old";
+	if (!FileExists(previous.c_str()))
 	{
-		ePTString = 0,
-		ePTInt,
-		ePTUInt,
-		ePTVector3,
-		ePTCollection
-	};
+		Journal.reset();
+		MoveFileDurably(JournalFile.c_str(), previous.c_str());
+		Journal.reset(new cJournal(JournalFile.c_str()));
+	}
+
+	// The fold runs on its own object system with cloned factories, sharing nothing with
+	// this one but the type names, which cTypeNames locks.
+	std::shared_ptr<cObjectSystem> folded(new cObjectSystem);
+	for (auto& f : Factories)
+		if (f)
+			folded->RegisterFactory(f->Clone());
+
+	const std::string snapshot = SnapshotFile;
+	Compactor = std::thread([this, folded, snapshot, previous]
+	{
+		try
+		{
+			const std::string temporary = snapshot + ".tmp";
+			folded->LoadBinary(snapshot.c_str());
+			folded->ReplayJournal(previous.c_str());
+			folded->SaveBinary(temporary.c_str());
+			MoveFileDurably(temporary.c_str(), snapshot.c_str());
+			remove(previous.c_str());
+		}
+		catch (...)
+		{
+			CompactionFailure = std::current_exception();
+		}
+	});
+}
+
+void cObjectSystem::WaitForCompaction()
+{
+	if (Compactor.joinable())
+		Compactor.join();
+	if (CompactionFailure)
+	{
+		std::exception_ptr failure;
+		std::swap(failure, CompactionFailure);
+		std::rethrow_exception(failure);
+	}
+}
+
+void cObjectSystem::CloseJournal()
+{
+	if (!Journal)
+		return;
+	Journal.reset();
+	SetDirtyTracking(false);
+	WaitForCompaction();
+}
+
+void cObjectSystem::ConvertXMLToBinary(const char* xmlFile, const char* binaryFile)
+{
+	cXMLDocument document(xmlFile);
+	tXMLElements elements;
+	std::vector<uint> counts;
+	std::vector<size_t> order;
+	std::vector<size_t> levelEnds;
+	const size_t diagnostics = Diagnostics ? Diagnostics->Get().size() : 0;
+	GetXMLElements(document, elements, counts);
+	ResolveXMLPrototypes(elements, order, levelEnds);
+
+	// Variants without an ID get new ones as LoadXML() into an empty system would assign them.
+	uint nextID = 0;
+	bool newIDs = false;
+	for (auto& element : elements)
+	{
+		if (element.Node->first_node("ID"))
+		{
+			uint id = 0;
+			cXMLNodeDeserializer loader(*element.Node);
+			if (!Diagnostics)
+				loader("ID", id);
+			else if (!loader.Find("ID", id))
+				continue;
+			nextID = std::max(nextID, id + 1);
+		}
+		else
+		{
+			newIDs = newIDs || element.IsVariant();
+		}
+	}
+
+	cBinarySnapshot snapshot;
+	std::vector<uint> types(Factories.size(), 0);
+	for (tTypeId id = 0; id < counts.size(); ++id)
+		if (counts[id])
+			types[id] = snapshot.AddType(Factories[id]->GetType(), Factories[id]->GetSchema(), counts[id]);
+
+	cBinaryWriter writer(binaryFile);
+	snapshot.Write(writer);
+	try
+	{
+		// Elements go through objects, so the conversion applies exactly the rules LoadXML()
+		// does. Prototypes of other elements are loaded first and kept, the others are
+		// scratch objects.
+		for (size_t i : order)
+		{
+			cXMLElement& element = elements[i];
+			if (!element.Referenced)
+				continue;
+			element.Object = element.Factory->Create(0, "");
+			LoadXMLElement(element, elements);
+		}
+		for (auto& element : elements)
+		{
+			iFactory* f = element.Factory;
+			if (!element.Referenced)
+			{
+				element.Object = f->Create(0, "");
+				LoadXMLElement(element, elements);
+			}
+			if (newIDs && element.IsVariant() && !element.Node->first_node("ID"))
+				element.Object->SetID(nextID++);
+			snapshot.BeginObject(writer, types[f->GetTypeId()]);
+			cBinarySnapshot::WriteValues(writer, element.Object->GetProperties());
+			if (!element.Referenced)
+			{
+				element.Object->SetPrototype(nullptr);
+				f->Destroy(element.Object);
+				element.Object = nullptr;
+			}
+		}
+	}
+	catch (...)
+	{
+		DestroyXMLElements(elements);
+		throw;
+	}
+	DestroyXMLElements(elements);
+	if (Diagnostics)
+		Diagnostics->Sort(diagnostics);
+	snapshot.WriteIndex(writer);
+	writer.Finish();
+}
+
+template <class T_>
+static void WriteBinaryArrayXML(cBinaryReader& r, cXMLWriter& w, const char* name)
+{
+	std::vector<T_> v;
+	r.GetArray(v);
+	WriteXMLArray(w, name, v);
+}
+
+// Writes the fields [i, end) of a snapshot layout as XML.
+static void WriteBinaryFieldsXML(cBinaryReader& r, cXMLWriter& w, const cBinarySnapshot& snapshot, const std::vector<cBinarySnapshot::cField>& layout, size_t& i, size_t end)
+{
+	while (i < end)
+	{
+		const cBinarySnapshot::cField& field = layout[i++];
+		const char* name = snapshot.GetName(field.Name).c_str();
+		switch (field.Type)
+		{
+		case cProperty::ePTInt: { int v; r.Get(&v, sizeof(v)); w.Value(name, FormatXMLValue(v)); } break;
+		case cProperty::ePTUInt: w.Value(name, FormatXMLValue(r.GetUInt())); break;
+		case cProperty::ePTString: { std::string v; r.GetString(v); w.Value(name, v); } break;
+		case cProperty::ePTVector3:
+		{
+			Vector3 v;
+			r.Get(&v, sizeof(v));
+			w.Begin(name);
+			w.Value("x", FormatXMLValue(v.X));
+			w.Value("y", FormatXMLValue(v.Y));
+			w.Value("z", FormatXMLValue(v.Z));
+			w.End(name);
+		}
+		break;
+		case cProperty::ePTCollection:
+			w.Begin(name);
+			WriteBinaryFieldsXML(r, w, snapshot, layout, i, i + field.Children);
+			w.End(name);
+			break;
+		case cProperty::ePTIntArray: WriteBinaryArrayXML<int>(r, w, name); break;
+		case cProperty::ePTUIntArray: WriteBinaryArrayXML<uint>(r, w, name); break;
+		case cProperty::ePTFloatArray: WriteBinaryArrayXML<float>(r, w, name); break;
+		case cProperty::ePTVector3Array: WriteBinaryArrayXML<Vector3>(r, w, name); break;
+		}
+	}
+}
+
+void cObjectSystem::ConvertBinaryToXML(const char* binaryFile, const char* xmlFile)
+{
+	cMappedFile mapping(binaryFile);
+	cBinaryReader reader(mapping.GetData(), mapping.GetSize(), binaryFile);
+	cBinarySnapshot snapshot;
+	snapshot.Read(reader);
+
+	cXMLWriter writer(xmlFile);
+	while (!reader.IsEnd())
+	{
+		const uint type = reader.GetUInt();
+		if (type >= snapshot.GetTypes().size())
+			reader.Fail("corrupted object type");
+
+		const cBinarySnapshot::cType& t = snapshot.GetTypes()[type];
+		size_t i = 0;
+		writer.Begin(t.Name.c_str());
+		WriteBinaryFieldsXML(reader, writer, snapshot, t.Layout, i, t.Layout.size());
+		writer.End(t.Name.c_str());
+	}
+	writer.Finish();
+}
+
+class cActor : public cBaseObject
+{
 public:
-	cProperty(const char* name, int& r) : Name(name), RInt(&r), Type(cProperty::ePTInt) {}
-	cProperty(const char* name, uint& r) : Name(name), RUInt(&r), Type(cProperty::ePTUInt) {}
-	cProperty(const char* name, Vector3& r) : Name(name), RVec3(&r), Type(cProperty::ePTVector3) {}
-	cProperty(const char* name, std::string& r) : Name(name), RStr(&r), Type(cProperty::ePTString) {}
-	cProperty(const char* name, const iIterableProperties& r) : Name(name), RCollection(&r), Type(cProperty::ePTCollection) {}
+	static const std::string SObjectType;
+	static const cPropertySchema SSchema;
 
-	const char* GetName() const { return Name.c_str(); }
-	ePropertyType GetType() const { return Type; }
+	template <class V_>
+	static void DescribeProperties(V_& v)
+	{
+		cBaseObject::DescribeProperties(v);
+		v("Name", &cActor::Name);
+		v("Health", &cActor::Health);
+		v("Position", &cActor::Pos);
+	}
 
-	template <typename T_>
-	T_ GetValue() const;
-	template <typename T_>
-	void SetValue(const T_& v);
+	cActor(uint id)
+		: cBaseObject(id, SObjectType.c_str())
+		, Name("Actor")
+		, Health(100)
+		, Pos(100.f, 50.f, 0.f)
+	{
+	}
+	~cActor() {}
 
-	template<class V_>
-	void Accept(V_& visitor);
+protected:
+	// cBaseObject:
+	virtual cPropertySet BindProperties() override { return cPropertySet(this); }
+	// cBaseObject.
 
 private:
-	const ePropertyType Type;
-	const std::string Name;
-	union
+	int Health;
+	cSharedString Name;
+	Vector3 Pos;
+};
+
+const std::string cActor::SObjectType = "Actor";
+const cPropertySchema cActor::SSchema = cPropertySchema::Build<cActor>();
+
+// A trader with its route and inventory, held in array properties.
+class cCaravan : public cBaseObject
+{
+public:
+	static const std::string SObjectType;
+	static const cPropertySchema SSchema;
+
+	template <class V_>
+	static void DescribeProperties(V_& v)
 	{
-		int* RInt;
-		uint* RUInt;
-		Vector3* RVec3;
-		std::string* RStr;
-		const iIterableProperties* RCollection;
-	};
+		cBaseObject::DescribeProperties(v);
+		v("Route", &cCaravan::Route);
+		v("Goods", &cCaravan::Goods);
+		v("Amounts", &cCaravan::Amounts);
+		v("Prices", &cCaravan::Prices);
+	}
+
+	cCaravan(uint id)
+		: cBaseObject(id, SObjectType.c_str())
+	{
+	}
+	~cCaravan() {}
+
+protected:
+	// cBaseObject:
+	virtual cPropertySet BindProperties() override { return cPropertySet(this); }
+	// cBaseObject.
+
+private:
+	tVector3Array Route;
+	tUIntArray Goods;
+	tIntArray Amounts;
+	tFloatArray Prices;
 };
 
-template<> int cProperty::GetValue() const
+const std::string cCaravan::SObjectType = "Caravan";
+const cPropertySchema cCaravan::SSchema = cPropertySchema::Build<cCaravan>();
+
+class cStopwatch
+{
+public:
+	typedef std::chrono::high_resolution_clock tClock;
+
+	cStopwatch() : Start(tClock::now()) {}
+
+	double GetMilliseconds() const { return std::chrono::duration<double, std::milli>(tClock::now() - Start).count(); }
+
+private:
+	tClock::time_point Start;
+};
+
+// Runtime cProperty::Accept visitors vs. statically dispatched VisitProperties() ones.
+void BenchmarkPropertyVisitors(size_t count)
 {
-	assert(Type == cProperty::ePTInt);
-	return *RInt;
+	printf("Property visitors, %u actors:\n", (uint)count);
+
+	std::vector<cActor> actors;
+	actors.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		actors.push_back(cActor((uint)i));
+
+	{
+		cStopwatch sw;
+		for (auto& actor : actors)
+		{
+			tBoostPTree pt;
+			cXMLSerializer saver(pt, actor.GetProperties());
+		}
+		printf("  save, cProperty::Accept  %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cStopwatch sw;
+		for (auto& actor : actors)
+		{
+			tBoostPTree pt;
+			cStaticXMLSerializer saver(pt);
+			VisitProperties(actor, saver);
+		}
+		printf("  save, VisitProperties    %10.1f ms\n", sw.GetMilliseconds());
+	}
+
+	tBoostPTree element;
+	cXMLSerializer(element, actors.front().GetProperties());
+	{
+		cStopwatch sw;
+		for (auto& actor : actors)
+			cXMLDeserializer loader(element, actor.GetProperties());
+		printf("  load, cProperty::Accept  %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cStopwatch sw;
+		for (auto& actor : actors)
+		{
+			cStaticXMLDeserializer loader(element);
+			VisitProperties(actor, loader);
+		}
+		printf("  load, VisitProperties    %10.1f ms\n", sw.GetMilliseconds());
+	}
 }
 
-template<> void cProperty::SetValue(const int& v)
+bool ReadFile(const char* file, std::string& content)
 {
-	assert(Type == cProperty::ePTInt);
-	*RInt = v;
+	std::ifstream stream(file, std::ios::binary);
+	content.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	return stream.good() || stream.eof();
 }
 
-template<> uint cProperty::GetValue() const
+// ptree + write_xml() vs. the streaming cXMLWriter path.
+void BenchmarkSaveXML(size_t count)
 {
-	assert(Type == cProperty::ePTUInt);
-	return *RUInt;
+	printf("SaveXML, %u actors:\n", (uint)count);
+
+	cObjectSystem system;
+	system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+	system.CreateN<cActor>(count, "Actor");
+
+	{
+		cStopwatch sw;
+		system.SaveXMLTree("benchmark_ptree.xml");
+		printf("  ptree + write_xml        %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cStopwatch sw;
+		system.SaveXML("benchmark_stream.xml");
+		printf("  cXMLWriter               %10.1f ms\n", sw.GetMilliseconds());
+	}
+
+	std::string a, b;
+	ReadFile("benchmark_ptree.xml", a);
+	ReadFile("benchmark_stream.xml", b);
+	printf("  output %s\n", (a == b) ? "identical" : "DIFFERS");
+	remove("benchmark_ptree.xml");
+	remove("benchmark_stream.xml");
 }
 
-template<> void cProperty::SetValue(const uint& v)
+// XML vs. binary snapshot save and load.
+void BenchmarkSnapshots(size_t count)
+{
+	printf("Snapshots, %u actors:\n", (uint)count);
+
+	{
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		system.CreateN<cActor>(count, "Actor");
+
+		cStopwatch xml;
+		system.SaveXML("benchmark.xml");
+		printf("  SaveXML                  %10.1f ms\n", xml.GetMilliseconds());
+
+		cStopwatch binary;
+		system.SaveBinary("benchmark.bin");
+		printf("  SaveBinary               %10.1f ms\n", binary.GetMilliseconds());
+	}
+	{
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		cStopwatch sw;
+		system.LoadXML("benchmark.xml");
+		printf("  LoadXML                  %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		cStopwatch sw;
+		system.LoadBinary("benchmark.bin");
+		printf("  LoadBinary               %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		cStopwatch sw;
+		system.LoadBinaryLazy("benchmark.bin");
+		printf("  LoadBinaryLazy           %10.1f ms\n", sw.GetMilliseconds());
+
+		cStopwatch hydrate;
+		system.SaveBinary("benchmark_lazy.bin");
+		printf("  SaveBinary (hydrating)   %10.1f ms\n", hydrate.GetMilliseconds());
+	}
+	remove("benchmark.xml");
+	remove("benchmark.bin");
+	remove("benchmark_lazy.bin");
+}
+
+// Serial vs. parallel SaveXML/LoadXML from one thread up to one per hardware thread.
+void BenchmarkParallelXML(size_t count)
 {
-	assert(Type == cProperty::ePTUInt);
-	*RUInt = v;
+	printf("Parallel XML, %u actors:\n", (uint)count);
+
+	std::string serial;
+	{
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		system.CreateN<cActor>(count, "Actor");
+
+		cStopwatch save;
+		system.SaveXML("benchmark.xml");
+		printf("  SaveXML serial           %10.1f ms\n", save.GetMilliseconds());
+		ReadFile("benchmark.xml", serial);
+
+		cObjectSystem loaded;
+		loaded.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		cStopwatch load;
+		loaded.LoadXML("benchmark.xml");
+		printf("  LoadXML serial           %10.1f ms\n", load.GetMilliseconds());
+
+		const uint maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (uint threads = 1; ; threads = std::min(threads * 2, maxThreads))
+		{
+			cWorkerPool pool(threads);
+
+			cStopwatch parallelSave;
+			system.SaveXML("benchmark_parallel.xml", pool);
+			const double saveTime = parallelSave.GetMilliseconds();
+
+			std::string parallel;
+			ReadFile("benchmark_parallel.xml", parallel);
+
+			cObjectSystem parallelLoaded;
+			parallelLoaded.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+			cStopwatch parallelLoad;
+			parallelLoaded.LoadXML("benchmark_parallel.xml", pool);
+			const double loadTime = parallelLoad.GetMilliseconds();
+
+			parallelLoaded.SaveXML("benchmark_parallel.xml");
+			std::string reloaded;
+			ReadFile("benchmark_parallel.xml", reloaded);
+
+			printf("  %2u threads: save %10.1f ms, load %10.1f ms, output %s\n", threads, saveTime, loadTime,
+				(parallel == serial && reloaded == serial) ? "identical" : "DIFFERS");
+			if (threads == maxThreads)
+				break;
+		}
+	}
+	remove("benchmark.xml");
+	remove("benchmark_parallel.xml");
 }
 
-template<> const char* cProperty::GetValue() const
+// Reading and writing one property of all actors by name through cPropertySet vs. Gather/Scatter.
+void BenchmarkGather(size_t count)
 {
-	assert(Type == cProperty::ePTString);
-	return RStr->c_str();
+	printf("Gather/Scatter, %u actors:\n", (uint)count);
+
+	cObjectSystem system;
+	system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+	std::vector<cObjectSystem::tHandle> handles;
+	system.CreateN<cActor>(count, "Actor", &handles);
+	const tTypeId type = cTypeNames::Of<cActor>();
+
+	std::vector<int> health(count);
+	{
+		cStopwatch sw;
+		for (size_t i = 0; i < count; ++i)
+			for (cProperty p : system.Get<cActor>(handles[i])->GetProperties())
+				if (strcmp(p.GetName(), "Health") == 0)
+				{
+					health[i] = p.GetValue<int>();
+					break;
+				}
+		printf("  get by name              %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cStopwatch sw;
+		system.Gather("Health", type, health.data(), health.size());
+		printf("  Gather                   %10.1f ms\n", sw.GetMilliseconds());
+	}
+	for (int& h : health)
+		--h;
+	{
+		cStopwatch sw;
+		for (size_t i = 0; i < count; ++i)
+			for (cProperty p : system.Get<cActor>(handles[i])->GetProperties())
+				if (strcmp(p.GetName(), "Health") == 0)
+				{
+					p.SetValue(health[i]);
+					break;
+				}
+		printf("  set by name              %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cStopwatch sw;
+		system.Scatter("Health", type, health.data(), health.size());
+		printf("  Scatter                  %10.1f ms\n", sw.GetMilliseconds());
+	}
 }
 
-template<> void cProperty::SetValue(const char* const& v)
+// Sweeping the positions of all actors: objects vs. columns (structure of arrays).
+void BenchmarkColumns(size_t count)
 {
-	assert(Type == cProperty::ePTString);
-	*RStr = v;
+	printf("Columns, %u actors:\n", (uint)count);
+
+	const tTypeId type = cTypeNames::Of<cActor>();
+	std::vector<Vector3> positions(count);
+	float sum = 0.f;
+	{
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		system.CreateN<cActor>(count, "Actor");
+
+		cStopwatch sw;
+		system.Gather("Position", type, positions.data(), positions.size());
+		for (const Vector3& p : positions)
+			sum += p.X;
+		printf("  objects, Gather          %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cObjectSystem::cColumnFactory<cActor>* factory = new cObjectSystem::cColumnFactory<cActor>(cActor::SObjectType.c_str());
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(factory));
+		system.CreateN<cActor>(count, "Actor");
+
+		cStopwatch gather;
+		system.Gather("Position", type, positions.data(), positions.size());
+		for (const Vector3& p : positions)
+			sum += p.X;
+		printf("  columns, Gather          %10.1f ms\n", gather.GetMilliseconds());
+
+		cStopwatch sweep;
+		const cPropertyColumns<cActor>& columns = factory->GetColumns();
+		const Vector3* column = columns.GetColumn<Vector3>("Position");
+		for (size_t i = 0; i < columns.GetRowCount(); ++i)
+			sum += column[i].X;
+		printf("  columns, sweep           %10.1f ms\n", sweep.GetMilliseconds());
+	}
+	printf("  (checksum %g)\n", sum);
 }
 
-template<> const Vector3& cProperty::GetValue() const
+// K_ against cScalarVector3Kernels for every count up to a few registers, so the wide loops,
+// their remainders and empty spans all run, on points inside, outside and on the faces of
+// the box. Elements past the count have to stay untouched. Prints and returns the failures.
+template <class K_, class V_>
+size_t CheckVector3Kernels(const char* name)
 {
-	assert(Type == cProperty::ePTVector3);
-	return *RVec3;
+	static const size_t SMaxCount = 40;
+	// The box is [0, 1]: 0 and 1 lie on its faces.
+	const float grid[] = { -1.f, 0.f, 0.5f, 1.f, 2.f };
+	const Vector3 boxMin(0.f, 0.f, 0.f), boxMax(1.f, 1.f, 1.f);
+	const Vector3 offset(0.5f, -1.f, 2.f), scale(2.f, -0.5f, 1.f), point(0.25f, 1.f, -0.5f);
+	const Vector3 unset(-7.f, -7.f, -7.f);
+
+	std::vector<V_> points;
+	std::vector<unsigned char> inside;
+	for (size_t i = 0; i <= SMaxCount; ++i)
+	{
+		const size_t x = i % 5, y = (i / 5) % 5, z = (i / 25 + i / 2) % 5;
+		points.push_back(V_(grid[x], grid[y], grid[z]));
+		inside.push_back(x >= 1 && x <= 3 && y >= 1 && y <= 3 && z >= 1 && z <= 3);
+	}
+
+	size_t failures = 0;
+	auto check = [&](bool passed, const char* kernel, size_t count)
+	{
+		if (passed)
+			return;
+		printf("  %s: %s fails for %u points\n", name, kernel, (uint)count);
+		++failures;
+	};
+	for (size_t count = 0; count <= SMaxCount; ++count)
+	{
+		std::vector<V_> a(points), b(points);
+		cScalarVector3Kernels::Translate(a.data(), count, offset);
+		cScalarVector3Kernels::Scale(a.data(), count, scale);
+		K_::Translate(b.data(), count, offset);
+		K_::Scale(b.data(), count, scale);
+		check(memcmp(a.data(), b.data(), a.size() * sizeof(V_)) == 0 &&
+			memcmp(&b[count], &points[count], (b.size() - count) * sizeof(V_)) == 0, "Translate/Scale", count);
+
+		std::vector<float> da(count + 1, -1.f), db(count + 1, -1.f);
+		cScalarVector3Kernels::GetDistances(points.data(), count, point, da.data());
+		K_::GetDistances(points.data(), count, point, db.data());
+		check(da == db, "GetDistances", count);
+
+		std::vector<unsigned char> expected(inside.begin(), inside.begin() + count), ib(count + 1, 2);
+		expected.push_back(2);
+		const size_t n = K_::TestAABB(points.data(), count, boxMin, boxMax, ib.data());
+		check(ib == expected && n == (size_t)std::count(inside.begin(), inside.begin() + count, 1) &&
+			K_::TestAABB(points.data(), count, boxMin, boxMax, nullptr) == n, "TestAABB", count);
+
+		Vector3 minA = unset, maxA = unset, minB = unset, maxB = unset;
+		const bool found = cScalarVector3Kernels::GetBounds(points.data(), count, minA, maxA);
+		check(K_::GetBounds(points.data(), count, minB, maxB) == (count != 0) && found == (count != 0) &&
+			memcmp(&minA, &minB, sizeof(Vector3)) == 0 && memcmp(&maxA, &maxB, sizeof(Vector3)) == 0, "GetBounds", count);
+	}
+	return failures;
 }
 
-template<> void cProperty::SetValue(const Vector3& v)
+template <class F_>
+bool IsParsedAs(const std::string& text, F_ expected)
 {
-	assert(Type == cProperty::ePTVector3);
-	*RVec3 = v;
+	F_ v;
+	return cFloatText<F_>::Parse(text.data(), text.data() + text.size(), v) && memcmp(&v, &expected, sizeof(F_)) == 0;
 }
 
-template<> const iIterableProperties& cProperty::GetValue() const
+template <class F_>
+bool IsRejected(const std::string& text)
 {
-	assert(Type == cProperty::ePTCollection);
-	return *RCollection;
+	F_ v;
+	return !cFloatText<F_>::Parse(text.data(), text.data() + text.size(), v);
 }
 
-template<> void cProperty::SetValue(const iIterableProperties& v)
+template <class F_>
+bool IsFormattedAs(F_ value, const char* expected)
 {
-	assert(Type == cProperty::ePTCollection);
-	RCollection = &v;
+	char buffer[cFloatText<F_>::SSize];
+	return std::string(buffer, cFloatText<F_>::Format(value, buffer)) == expected;
 }
 
-template<class V_>
-void cProperty::Accept(V_& visitor)
-{
-	switch (Type)
+// Syntax of cFloatText<F_> both ways, plus Format() then Parse() giving back the same bits for
+// the extremes and 'count' pseudo random bit patterns of every class. Prints and returns the
+// failures.
+template <class F_>
+size_t CheckFloatText(const char* name, size_t count)
+{
+	typedef typename cFloatBits<F_>::tBits tBits;
+	typedef std::numeric_limits<F_> tLimits;
+
+	size_t failures = 0;
+	auto check = [&](bool passed, const std::string& text)
+	{
+		if (passed)
+			return;
+		printf("  %s: fails for \"%.40s\"%s\n", name, text.c_str(), text.size() > 40 ? "..." : "");
+		++failures;
+	};
+
+	const char* valid[] = { "0", "-0", "1.", ".5", " 2.5e+3\t", "1E-2", "00012.50e01", "inf", "-INF", "Nan" };
+	const F_ values[] = { F_(0), -F_(0), F_(1), F_(0.5), F_(2500), F_(0.01), F_(125), tLimits::infinity(), -tLimits::infinity(), tLimits::quiet_NaN() };
+	for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); ++i)
+	{
+		F_ v;
+		check(cFloatText<F_>::Parse(valid[i], valid[i] + strlen(valid[i]), v) &&
+			((v != v) ? values[i] != values[i] : memcmp(&v, &values[i], sizeof(F_)) == 0), valid[i]);
+	}
+	const char* garbage[] = { "", " ", "-", "+", ".", "-.", "e5", "1e", "1e+", "1.2.3", "1,5", "0x10", "1f", "1 2",
+		"--1", "+-1", "- 1", "infinity", "infx", "in", "-na", "nan(1)", "1e5x" };
+	for (size_t i = 0; i < sizeof(garbage) / sizeof(garbage[0]); ++i)
+		check(IsRejected<F_>(garbage[i]), garbage[i]);
+
+	// Overlong mantissas: leading zeros do not count, and past the kept digits only whether
+	// any is nonzero decides a tie.
+	check(IsParsedAs("0." + std::string(1000, '0') + "1e1001", F_(1)), "0.000...1e1001");
+	check(IsParsedAs("1" + std::string(1000, '0') + "e-1000", F_(1)), "1000...e-1000");
+
+	F_ extremes[] = { tLimits::denorm_min(), -tLimits::denorm_min(), tLimits::min() - tLimits::denorm_min(), tLimits::min(),
+		tLimits::max(), -tLimits::max(), tLimits::epsilon(), F_(0.1), F_(1) / F_(3) };
+	for (size_t i = 0; i < sizeof(extremes) / sizeof(extremes[0]); ++i)
 	{
-	case cProperty::ePTInt: visitor.Visit<ePTInt>(*this); break;
-	case cProperty::ePTUInt: visitor.Visit<ePTUInt>(*this); break;
-	case cProperty::ePTString: visitor.Visit<ePTString>(*this); break;
-	case cProperty::ePTVector3: visitor.Visit<ePTVector3>(*this); break;
-	case cProperty::ePTCollection: visitor.Visit<ePTCollection>(*this); break;
-	default: assert(false);
+		char buffer[cFloatText<F_>::SSize];
+		const std::string text(buffer, cFloatText<F_>::Format(extremes[i], buffer));
+		check(IsParsedAs(text, extremes[i]), text);
 	}
+
+	tBits state = tBits(0x9E3779B97F4A7C15ull);
+	for (size_t i = 0; i < count; ++i)
+	{
+		// Xorshift, its high bits spreading over all exponents, including the subnormal ones.
+		state ^= state << 13;
+		state ^= state >> (sizeof(tBits) == 4 ? 17 : 7);
+		state ^= state << (sizeof(tBits) == 4 ? 5 : 17);
+		F_ value;
+		memcpy(&value, &state, sizeof(value));
+		if (value != value || value - value != 0)
+			continue;
+		char buffer[cFloatText<F_>::SSize];
+		const std::string text(buffer, cFloatText<F_>::Format(value, buffer));
+		check(IsParsedAs(text, value), text);
+	}
+	return failures;
 }
 
-class cXMLSerializer
+// Correct rounding of cFloatText at the edges of the formats, where the fast paths give way to
+// the exact one: subnormals, the largest finite values and exact ties, written out to all
+// their digits.
+size_t CheckFloatRounding()
 {
-public:
-	cXMLSerializer(tBoostPTree& pt, iPropertyIterator& iter);
+	size_t failures = 0;
+	auto check = [&](bool passed, const char* what)
+	{
+		if (passed)
+			return;
+		printf("  float text: %s fails\n", what);
+		++failures;
+	};
+	typedef std::numeric_limits<float> tFloat;
+	typedef std::numeric_limits<double> tDouble;
 
-	template <cProperty::ePropertyType T_>
-	void Visit(cProperty& p);
+	// 2^-150 and 2^-1075, half the smallest subnormal: ties round to the even zero, anything
+	// above, however far down its first nonzero digit, to the subnormal.
+	const std::string floatHalf = "7.00649232162408535461864791644958065640130970938257885878534141944895541342930300743319094181060791015625e-46";
+	const std::string doubleHalf = "2.4703282292062327208828439643411068618252990130716238221279284125033775363510437593264991818081799618989828234772285886546332835517796989819938739800539093906315035659515570226392290858392449105184435931802849936536152500319370457678249219365623669863658480757001585769269903706311928279558551332927834338409351978015531246597263579574622766465272827220056374006485499977096599470454020828166226237857393450736339007967761930577506740176324673600968951340535537458516661134223766678604162159680461914467291840300530057530849048765391711386591646239524912623653881879636239373280423891018672348497668235089863388587925628302755995657524455507255189313690836254779186948667994968324049705821028513185451396213837722826145437693412532098591327667236328125e-324";
+	check(IsParsedAs(floatHalf, 0.f) && IsParsedAs(doubleHalf, 0.), "subnormal tie");
+	check(IsParsedAs(floatHalf.substr(0, floatHalf.size() - 4) + "0000000001e-46", tFloat::denorm_min()), "float subnormal above tie");
+	check(IsParsedAs(doubleHalf.substr(0, doubleHalf.size() - 5) + std::string(900, '0') + "1e-324", tDouble::denorm_min()), "double subnormal above tie");
+	check(IsParsedAs("1.4e-45", tFloat::denorm_min()) && IsParsedAs("4.9406564584124654e-324", tDouble::denorm_min()), "smallest subnormal");
+	check(IsParsedAs("1.1754942e-38", tFloat::min() - tFloat::denorm_min()) && IsParsedAs("2.2250738585072009e-308", tDouble::min() - tDouble::denorm_min()), "largest subnormal");
+	check(IsParsedAs("1e-46", 0.f) && IsParsedAs("2e-324", 0.) && IsParsedAs("-1e-400", -0.), "underflow");
 
-private:
-	tBoostPTree& PT;
-};
+	// FLT_MAX and DBL_MAX, and the ties between them and the next power of two, which round
+	// to infinity.
+	check(IsParsedAs("3.4028235e38", tFloat::max()) && IsParsedAs("1.7976931348623157e308", tDouble::max()), "largest finite");
+	check(IsParsedAs("3.4028235677973365e38", tFloat::max()) && IsParsedAs("1.7976931348623158e308", tDouble::max()), "below the overflow tie");
+	check(IsParsedAs("340282356779733661637539395458142568448", tFloat::infinity()) &&
+		IsParsedAs("179769313486231580793728971405303415079934132710037826936173778980444968292764750946649017977587207096330286416692887910946555547851940402630657488671505820681908902000708383676273854845817711531764475730270069855571366959622842914819860834936475292719074168444365510704342711559699508093042880177904174497792", tDouble::infinity()) &&
+		IsParsedAs("-1e309", -tDouble::infinity()), "overflow");
 
-cXMLSerializer::cXMLSerializer(tBoostPTree& pt, iPropertyIterator& iter)
-	: PT(pt)
-{
-	while (iter.Next())
-		iter.Get().Accept(*this);
-}
+	// Ties in the normal range go to the even mantissa, the least excess breaks them.
+	check(IsParsedAs("16777217", 16777216.f) && IsParsedAs("16777219", 16777220.f) &&
+		IsParsedAs("9007199254740993", 9007199254740992.) && IsParsedAs("9007199254740995", 9007199254740996.), "normal tie");
+	check(IsParsedAs("16777217." + std::string(900, '0') + "1", 16777218.f) &&
+		IsParsedAs("9007199254740993." + std::string(900, '0') + "1", 9007199254740994.) &&
+		IsParsedAs("9007199254740993" + std::string(900, '0') + "e-900", 9007199254740992.), "normal tie, overlong");
 
-template<> void cXMLSerializer::Visit<cProperty::ePTInt>(cProperty& p)
-{
-	PT.put<int>(p.GetName(), p.GetValue<int>());
+	check(IsFormattedAs(tFloat::max(), "3.4028235e+38") && IsFormattedAs(tDouble::max(), "1.7976931348623157e+308"), "format largest finite");
+	check(IsFormattedAs(tFloat::denorm_min(), "1e-45") && IsFormattedAs(tDouble::denorm_min(), "5e-324"), "format smallest subnormal");
+	check(IsFormattedAs(0.1f, "0.1") && IsFormattedAs(-0., "-0") && IsFormattedAs(1e21, "1e+21") && IsFormattedAs(1e-7, "1e-7"), "format");
+	return failures;
 }
 
-template<> void cXMLSerializer::Visit<cProperty::ePTUInt>(cProperty& p)
+// Checks of results the benchmarks only time; true if all pass.
+bool RunSelfChecks()
 {
-	PT.put<uint>(p.GetName(), p.GetValue<uint>());
+	size_t failures = 0;
+	failures += CheckFloatText<float>("float text", 200000);
+	failures += CheckFloatText<double>("double text", 200000);
+	failures += CheckFloatRounding();
+	failures += CheckVector3Kernels<cScalarVector3Kernels, Vector3>("scalar Vector3");
+	failures += CheckVector3Kernels<cScalarVector3Kernels, Vector3A>("scalar Vector3A");
+#ifdef PTREE_SSE
+	failures += CheckVector3Kernels<cSimdVector3Kernels<cSimd4>, Vector3>("SSE Vector3");
+	failures += CheckVector3Kernels<cSimdVector3Kernels<cSimd4>, Vector3A>("SSE Vector3A");
+#endif
+#ifdef PTREE_AVX
+	failures += CheckVector3Kernels<cSimdVector3Kernels<cSimd8>, Vector3>("AVX Vector3");
+	failures += CheckVector3Kernels<cSimdVector3Kernels<cSimd8>, Vector3A>("AVX Vector3A");
+#endif
+	printf("Self checks: %u failures\n", (uint)failures);
+	return failures == 0;
 }
 
-template<> void cXMLSerializer::Visit<cProperty::ePTString>(cProperty& p)
+// Batch kernels on the Position column of 1M actors: per object through cProperty vs. the
+// scalar loops vs. cVector3Kernels, checking that the SIMD results match the scalar ones.
+void BenchmarkVector3Kernels(size_t count)
 {
-	PT.put<std::string>(p.GetName(), p.GetValue<const char*>());
-}
+#if defined(PTREE_AVX)
+	printf("Vector3 kernels (AVX), %u actors:\n", (uint)count);
+#elif defined(PTREE_SSE)
+	printf("Vector3 kernels (SSE), %u actors:\n", (uint)count);
+#else
+	printf("Vector3 kernels (scalar), %u actors:\n", (uint)count);
+#endif
 
-template<> void cXMLSerializer::Visit<cProperty::ePTVector3>(cProperty& p)
-{
-	const Vector3& v = p.GetValue<const Vector3&>();
-	tBoostPTree pt;
-	pt.put<float>("x", v.X);
-	pt.put<float>("y", v.Y);
-	pt.put<float>("z", v.Z);
-	PT.add_child(p.GetName(), pt);
+	cObjectSystem::cColumnFactory<cActor>* factory = new cObjectSystem::cColumnFactory<cActor>(cActor::SObjectType.c_str());
+	cObjectSystem system;
+	system.RegisterFactory(cObjectSystem::rFactory(factory));
+	std::vector<cObjectSystem::tHandle> handles;
+	system.CreateN<cActor>(count, "Actor", &handles);
+
+	Vector3* column = factory->GetColumns().GetColumn<Vector3>("Position");
+	uint seed = 1;
+	for (size_t i = 0; i < count; ++i)
+	{
+		float c[3];
+		for (float& v : c)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			v = (float)(seed >> 8) / (1 << 24) * 2000.f - 1000.f;
+		}
+		column[i] = Vector3(c[0], c[1], c[2]);
+	}
+	const Vector3 offset(1.5f, -2.25f, 0.125f);
+	const Vector3 scale(0.5f, 2.f, -1.f);
+	const Vector3 boxMin(-250.f, -500.f, -100.f);
+	const Vector3 boxMax(750.f, 500.f, 900.f);
+	bool identical = true;
+
+	{
+		cStopwatch sw;
+		for (auto& h : handles)
+			for (cProperty p : system.Get<cActor>(h)->GetProperties())
+				if (p.GetType() == cProperty::ePTVector3)
+				{
+					const Vector3& v = p.GetValue<const Vector3&>();
+					p.SetValue(Vector3(v.X + offset.X, v.Y + offset.Y, v.Z + offset.Z));
+				}
+		printf("  translate, cProperty     %10.1f ms\n", sw.GetMilliseconds());
+	}
+
+	std::vector<Vector3> reference(column, column + count);
+	{
+		cStopwatch scalar;
+		cScalarVector3Kernels::Translate(reference.data(), count, offset);
+		cScalarVector3Kernels::Scale(reference.data(), count, scale);
+		const double scalarTime = scalar.GetMilliseconds();
+		cStopwatch simd;
+		cVector3Kernels::Translate(column, count, offset);
+		cVector3Kernels::Scale(column, count, scale);
+		printf("  translate + scale        %10.1f ms scalar, %10.1f ms SIMD\n", scalarTime, simd.GetMilliseconds());
+		identical &= memcmp(reference.data(), column, count * sizeof(Vector3)) == 0;
+	}
+	{
+		std::vector<float> a(count), b(count);
+		cStopwatch scalar;
+		cScalarVector3Kernels::GetDistances(reference.data(), count, offset, a.data());
+		const double scalarTime = scalar.GetMilliseconds();
+		cStopwatch simd;
+		cVector3Kernels::GetDistances(column, count, offset, b.data());
+		printf("  distances                %10.1f ms scalar, %10.1f ms SIMD\n", scalarTime, simd.GetMilliseconds());
+		identical &= a == b;
+	}
+	{
+		std::vector<unsigned char> a(count), b(count);
+		cStopwatch scalar;
+		const size_t na = cScalarVector3Kernels::TestAABB(reference.data(), count, boxMin, boxMax, a.data());
+		const double scalarTime = scalar.GetMilliseconds();
+		cStopwatch simd;
+		const size_t nb = cVector3Kernels::TestAABB(column, count, boxMin, boxMax, b.data());
+		printf("  AABB test                %10.1f ms scalar, %10.1f ms SIMD (%u inside)\n", scalarTime, simd.GetMilliseconds(), (uint)nb);
+		identical &= na == nb && a == b;
+	}
+	{
+		Vector3 minA, maxA, minB, maxB;
+		cStopwatch scalar;
+		cScalarVector3Kernels::GetBounds(reference.data(), count, minA, maxA);
+		const double scalarTime = scalar.GetMilliseconds();
+		cStopwatch simd;
+		cVector3Kernels::GetBounds(column, count, minB, maxB);
+		printf("  bounds                   %10.1f ms scalar, %10.1f ms SIMD\n", scalarTime, simd.GetMilliseconds());
+		identical &= memcmp(&minA, &minB, sizeof(Vector3)) == 0 && memcmp(&maxA, &maxB, sizeof(Vector3)) == 0;
+	}
+	{
+		std::vector<Vector3A> padded(count);
+		for (size_t i = 0; i < count; ++i)
+			padded[i] = Vector3A(column[i]);
+		std::vector<float> a(count), b(count);
+		cStopwatch sw;
+		cVector3Kernels::Translate(padded.data(), count, offset);
+		cVector3Kernels::GetDistances(padded.data(), count, offset, b.data());
+		printf("  Vector3A translate + dist %10.1f ms SIMD\n", sw.GetMilliseconds());
+		cScalarVector3Kernels::Translate(reference.data(), count, offset);
+		cScalarVector3Kernels::GetDistances(reference.data(), count, offset, a.data());
+		identical &= a == b;
+	}
+	printf("  results %s\n", identical ? "identical" : "DIFFER");
 }
 
-template<> void cXMLSerializer::Visit<cProperty::ePTCollection>(cProperty& p)
+// stream_translator vs. cFloatTranslator on float text, including how many values survive a
+// put/get round trip bit-exactly.
+void BenchmarkFloatText(size_t count)
 {
-	tBoostPTree pt;
-	cXMLSerializer(pt, *p.GetValue<const iIterableProperties&>().CreateIterator());
-	PT.add_child(p.GetName(), pt);
+	printf("Float text, %u values:\n", (uint)count);
+
+	std::vector<float> values(count);
+	uint seed = 1;
+	for (float& v : values)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		v = (float)(seed >> 8) / (1 << 24) * 2000.f - 1000.f;
+	}
+	std::vector<std::string> texts(count);
+
+	typedef boost::property_tree::stream_translator<char, std::char_traits<char>, std::allocator<char>, float> tStream;
+	typedef boost::property_tree::translator_between<std::string, float>::type tFast;
+	tStream stream;
+	tFast fast;
+	{
+		cStopwatch put;
+		for (size_t i = 0; i < count; ++i)
+			texts[i] = *stream.put_value(values[i]);
+		const double putTime = put.GetMilliseconds();
+		size_t exact = 0;
+		cStopwatch get;
+		for (size_t i = 0; i < count; ++i)
+			exact += *stream.get_value(texts[i]) == values[i];
+		printf("  stream_translator        %10.1f ms put, %10.1f ms get, %u round trip exactly\n", putTime, get.GetMilliseconds(), (uint)exact);
+	}
+	{
+		cStopwatch put;
+		for (size_t i = 0; i < count; ++i)
+			texts[i] = *fast.put_value(values[i]);
+		const double putTime = put.GetMilliseconds();
+		size_t exact = 0;
+		cStopwatch get;
+		for (size_t i = 0; i < count; ++i)
+			exact += *fast.get_value(texts[i]) == values[i];
+		printf("  cFloatTranslator         %10.1f ms put, %10.1f ms get, %u round trip exactly\n", putTime, get.GetMilliseconds(), (uint)exact);
+	}
 }
 
-class cXMLDeserializer
+// stream_translator vs. cIntegerTranslator on int text.
+void BenchmarkIntegerText(size_t count)
 {
-public:
-	cXMLDeserializer(tBoostPTree& pt, iPropertyIterator& iter);
+	printf("Integer text, %u values:\n", (uint)count);
 
-	template <cProperty::ePropertyType T_>
-	void Visit(cProperty& p);
+	std::vector<int> values(count);
+	uint seed = 1;
+	for (int& v : values)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		v = (int)seed >> (seed & 31);
+	}
+	std::vector<std::string> texts(count);
 
-private:
-	tBoostPTree& PT;
-};
+	typedef boost::property_tree::stream_translator<char, std::char_traits<char>, std::allocator<char>, int> tStream;
+	typedef boost::property_tree::translator_between<std::string, int>::type tFast;
+	tStream stream;
+	tFast fast;
+	{
+		cStopwatch put;
+		for (size_t i = 0; i < count; ++i)
+			texts[i] = *stream.put_value(values[i]);
+		const double putTime = put.GetMilliseconds();
+		size_t same = 0;
+		cStopwatch get;
+		for (size_t i = 0; i < count; ++i)
+			same += *stream.get_value(texts[i]) == values[i];
+		printf("  stream_translator        %10.1f ms put, %10.1f ms get, %u round trip\n", putTime, get.GetMilliseconds(), (uint)same);
+	}
+	{
+		cStopwatch put;
+		for (size_t i = 0; i < count; ++i)
+			texts[i] = *fast.put_value(values[i]);
+		const double putTime = put.GetMilliseconds();
+		size_t same = 0;
+		cStopwatch get;
+		for (size_t i = 0; i < count; ++i)
+			same += *fast.get_value(texts[i]) == values[i];
+		printf("  cIntegerTranslator       %10.1f ms put, %10.1f ms get, %u round trip\n", putTime, get.GetMilliseconds(), (uint)same);
+	}
+}
 
-cXMLDeserializer::cXMLDeserializer(tBoostPTree& pt, iPropertyIterator& iter)
-	: PT(pt)
+// stream_translator vs. cCachedStreamTranslator on one type.
+template <class T_>
+void BenchmarkStreamTranslator(const char* name, const std::vector<T_>& values)
 {
-	while (iter.Next())
-		iter.Get().Accept(*this);
+	typedef boost::property_tree::stream_translator<char, std::char_traits<char>, std::allocator<char>, T_> tStream;
+	typedef cCachedStreamTranslator<char, std::char_traits<char>, std::allocator<char>, T_> tCached;
+
+	const size_t count = values.size();
+	std::vector<std::string> texts(count);
+	double times[2][2];
+	size_t same[2] = { 0, 0 };
+	{
+		tStream stream;
+		cStopwatch put;
+		for (size_t i = 0; i < count; ++i)
+			texts[i] = *stream.put_value(values[i]);
+		times[0][0] = put.GetMilliseconds();
+		cStopwatch get;
+		for (size_t i = 0; i < count; ++i)
+			same[0] += *stream.get_value(texts[i]) == values[i];
+		times[0][1] = get.GetMilliseconds();
+	}
+	{
+		tCached cached;
+		cStopwatch put;
+		for (size_t i = 0; i < count; ++i)
+			texts[i] = *cached.put_value(values[i]);
+		times[1][0] = put.GetMilliseconds();
+		cStopwatch get;
+		for (size_t i = 0; i < count; ++i)
+			same[1] += *cached.get_value(texts[i]) == values[i];
+		times[1][1] = get.GetMilliseconds();
+	}
+	printf("  %-12s put %10.1f ms stream, %10.1f ms cached\n", name, times[0][0], times[1][0]);
+	printf("  %-12s get %10.1f ms stream, %10.1f ms cached (%u / %u round trip)\n", name, times[0][1], times[1][1], (uint)same[0], (uint)same[1]);
 }
 
-template<> void cXMLDeserializer::Visit<cProperty::ePTInt>(cProperty& p)
+void BenchmarkCachedStreams(size_t count)
 {
-	p.SetValue(PT.get<int>(p.GetName()));
+	printf("Cached conversion streams, %u values:\n", (uint)count);
+
+	std::vector<bool> flags(count);
+	std::vector<long double> numbers(count);
+	uint seed = 1;
+	for (size_t i = 0; i < count; ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		flags[i] = (seed >> 16) & 1;
+		numbers[i] = (long double)(seed >> 8) / 1024;
+	}
+	BenchmarkStreamTranslator("bool", flags);
+	BenchmarkStreamTranslator("long double", numbers);
 }
 
-template<> void cXMLDeserializer::Visit<cProperty::ePTUInt>(cProperty& p)
+// One child element per value, as lists had to be saved before the array types.
+template <class T_>
+void PutXMLChildren(tBoostPTree& pt, const char* name, const std::vector<T_>& v)
 {
-	p.SetValue(PT.get<uint>(p.GetName()));
+	tBoostPTree& list = pt.add_child(name, tBoostPTree());
+	for (const T_& e : v)
+		list.add("Item", e);
 }
 
-template<> void cXMLDeserializer::Visit<cProperty::ePTString>(cProperty& p)
+void PutXMLChildren(tBoostPTree& pt, const char* name, const tVector3Array& v)
 {
-	p.SetValue(PT.get<std::string>(p.GetName()).c_str());
+	tBoostPTree& list = pt.add_child(name, tBoostPTree());
+	for (const Vector3& e : v)
+	{
+		tBoostPTree& item = list.add_child("Item", tBoostPTree());
+		item.put("x", e.X);
+		item.put("y", e.Y);
+		item.put("z", e.Z);
+	}
 }
 
-template<> void cXMLDeserializer::Visit<cProperty::ePTVector3>(cProperty& p)
+template <class T_>
+void GetXMLChildren(const tBoostPTree& pt, const char* name, std::vector<T_>& v)
 {
-	tBoostPTree pt = PT.get_child(p.GetName());
-	p.SetValue(Vector3(pt.get<float>("x"), pt.get<float>("y"), pt.get<float>("z")));
+	v.clear();
+	for (auto& item : pt.get_child(name))
+		v.push_back(item.second.get_value<T_>());
 }
 
-template<> void cXMLDeserializer::Visit<cProperty::ePTCollection>(cProperty& p)
+void GetXMLChildren(const tBoostPTree& pt, const char* name, tVector3Array& v)
 {
-	tBoostPTree pt = PT.get_child(p.GetName());
-	cXMLDeserializer(pt, *p.GetValue<const iIterableProperties&>().CreateIterator());
+	v.clear();
+	for (auto& item : pt.get_child(name))
+		v.push_back(Vector3(item.second.get<float>("x"), item.second.get<float>("y"), item.second.get<float>("z")));
 }
 
-class cPropertiesList : public iIterableProperties
+// Caravans with routes and inventories of 'length' entries: one element per value vs. packed
+// text vs. packed base64 vs. binary snapshots, with file sizes and a check that every packed
+// format loads back to the same objects.
+void BenchmarkArrays(size_t count, size_t length)
 {
-public:
-	typedef std::unique_ptr<cProperty> rProperty;
-
-public:
-	// iIterableProperties:
-	virtual rUniquePIterator CreateIterator() const override { return rUniquePIterator(new cIterator(Properties)); }
-	// iIterableProperties.
+	printf("Array properties, %u caravans of %u entries:\n", (uint)count, (uint)length);
 
-	void Register(rProperty p) { Properties.push_back(std::move(p)); }
+	cObjectSystem system;
+	system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cCaravan>(cCaravan::SObjectType.c_str())));
+	std::vector<cObjectSystem::tHandle> handles;
+	system.CreateN<cCaravan>(count, "Caravan", &handles);
 
-private:
-	typedef std::vector<rProperty> tProperties;
-
-	class cIterator : public iPropertyIterator
+	tVector3Array route(length);
+	tUIntArray goods(length);
+	tIntArray amounts(length);
+	tFloatArray prices(length);
+	uint seed = 1;
+	for (auto& h : handles)
 	{
-	public:
-		cIterator(const tProperties& properties) : Properties(properties), Index(-1) {}
-
-		// iPropertyIterator:
-		virtual bool Next() override { return ++Index < (int)Properties.size(); }
-		virtual cProperty& Get() override { assert(Index < (int)Properties.size()); return *Properties[Index]; }
-		// iPropertyIterator.
+		for (size_t i = 0; i < length; ++i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			route[i] = Vector3((float)(seed >> 8) / 256.f, (float)(seed & 0xffff) / 64.f, 0.f);
+			goods[i] = seed >> 20;
+			amounts[i] = (int)(seed >> 24) - 128;
+			prices[i] = (float)(seed >> 12) / 100.f;
+		}
+		for (cProperty p : system.Get<cCaravan>(h)->GetProperties())
+		{
+			switch (p.GetType())
+			{
+			case cProperty::ePTVector3Array: p.SetValue(route); break;
+			case cProperty::ePTUIntArray: p.SetValue(goods); break;
+			case cProperty::ePTIntArray: p.SetValue(amounts); break;
+			case cProperty::ePTFloatArray: p.SetValue(prices); break;
+			default: break;
+			}
+		}
+	}
 
-	private:
-		const tProperties& Properties;
-		int Index;
-	};
+	std::string text;
+	std::string reference;
+	bool identical = true;
+	const char* files[] = { "benchmark_text.xml", "benchmark_base64.xml", "benchmark.bin" };
+	const char* labels[] = { "packed text", "packed base64", "binary snapshot" };
+	for (int format = 0; format < 3; ++format)
+	{
+		system.SetXMLBase64Arrays(format == 1);
+		cStopwatch save;
+		if (format < 2)
+			system.SaveXML(files[format]);
+		else
+			system.SaveBinary(files[format]);
+		const double saveTime = save.GetMilliseconds();
 
-private:
-	tProperties Properties;
-};
+		cObjectSystem loaded;
+		loaded.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cCaravan>(cCaravan::SObjectType.c_str())));
+		cStopwatch load;
+		if (format < 2)
+			loaded.LoadXML(files[format]);
+		else
+			loaded.LoadBinary(files[format]);
+		const double loadTime = load.GetMilliseconds();
 
-struct iBaseObject
-{
-	virtual ~iBaseObject() {}
+		ReadFile(files[format], text);
+		printf("  %-18s save %10.1f ms, load %10.1f ms, %10u bytes\n", labels[format], saveTime, loadTime, (uint)text.size());
 
-	virtual iIterableProperties& GetProperties() = 0;
-	virtual uint GetID() const = 0;
-	virtual const char* GetObjectType() const = 0;
-};
+		std::string reloaded;
+		loaded.SaveXML("benchmark_reloaded.xml");
+		ReadFile("benchmark_reloaded.xml", reloaded);
+		if (format == 0)
+			reference = reloaded;
+		identical &= reloaded == reference;
+	}
+	ReadFile("benchmark_text.xml", text);
+	printf("  reloaded objects %s\n", (identical && text == reference) ? "identical" : "DIFFER");
 
-class cBaseObject : public iBaseObject
-{
-public:
-	cBaseObject(uint id, const char* type)
-		: ID(id)
-		, ObjectType(type)
+	// One element per value runs last; freeing its large trees skews whatever is timed next.
 	{
-		PList.Register(cPropertiesList::rProperty(new cProperty("ID", ID)));
-	}
+		tBoostPTree pt;
+		cStopwatch save;
+		for (auto& h : handles)
+		{
+			tBoostPTree& element = pt.add_child(cCaravan::SObjectType, tBoostPTree());
+			cPropertySet properties = system.Get<cCaravan>(h)->GetProperties();
+			for (cProperty p : properties)
+			{
+				switch (p.GetType())
+				{
+				case cProperty::ePTUInt: element.put(p.GetName(), p.GetValue<uint>()); break;
+				case cProperty::ePTVector3Array: PutXMLChildren(element, p.GetName(), p.GetValue<const tVector3Array&>()); break;
+				case cProperty::ePTUIntArray: PutXMLChildren(element, p.GetName(), p.GetValue<const tUIntArray&>()); break;
+				case cProperty::ePTIntArray: PutXMLChildren(element, p.GetName(), p.GetValue<const tIntArray&>()); break;
+				case cProperty::ePTFloatArray: PutXMLChildren(element, p.GetName(), p.GetValue<const tFloatArray&>()); break;
+				default: break;
+				}
+			}
+		}
+		write_xml("benchmark_children.xml", pt);
+		const double saveTime = save.GetMilliseconds();
 
-	// iBaseProperties:
-	iIterableProperties& GetProperties() { return PList; }
-	virtual uint GetID() const { return ID; }
-	virtual const char* GetObjectType() const { return ObjectType.c_str(); }
-	// iBaseProperties.
+		cStopwatch load;
+		tBoostPTree loaded;
+		read_xml("benchmark_children.xml", loaded);
+		for (auto& element : loaded)
+		{
+			GetXMLChildren(element.second, "Route", route);
+			GetXMLChildren(element.second, "Goods", goods);
+			GetXMLChildren(element.second, "Amounts", amounts);
+			GetXMLChildren(element.second, "Prices", prices);
+		}
+		const double loadTime = load.GetMilliseconds();
+		ReadFile("benchmark_children.xml", text);
+		printf("  element per value  save %10.1f ms, load %10.1f ms, %10u bytes\n", saveTime, loadTime, (uint)text.size());
+	}
 
-protected:
-	uint ID;
-	std::string ObjectType;
-	cPropertiesList PList;
-};
+	remove("benchmark_children.xml");
+	remove("benchmark_text.xml");
+	remove("benchmark_base64.xml");
+	remove("benchmark.bin");
+	remove("benchmark_reloaded.xml");
+}
 
-class cObjectSystem
+// Near identical actors saved complete vs. as variants of one prototype.
+void BenchmarkPrototypes(size_t count)
 {
-public:
-	struct iFactory
-	{
-		virtual ~iFactory() {}
+	printf("Prototypes, %u variants of one actor:\n", (uint)count);
 
-		virtual iBaseObject* Create(uint id, const char* name) const = 0;
-		virtual const char* GetType() const = 0;
-	};
+	cObjectSystem system;
+	system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+	const tTypeId type = cTypeNames::Of<cActor>();
+	cObjectSystem::tHandle prototype = system.Create<cActor>("Termogoyf");
+	for (cProperty p : system.Get<cActor>(prototype)->GetProperties())
+		if (strcmp(p.GetName(), "Name") == 0)
+			p.SetValue<const char*>("Lesser Termogoyf of the Eastern Marshes");
 
-	typedef std::unique_ptr<iFactory> rFactory;
+	std::vector<cObjectSystem::tHandle> handles(count);
+	{
+		cStopwatch sw;
+		for (auto& h : handles)
+			h = system.Instantiate(prototype);
+		printf("  Instantiate              %10.1f ms\n", sw.GetMilliseconds());
+	}
+	// Every variant differs in its health.
+	std::vector<int> health(count + 1);
+	for (size_t i = 0; i < health.size(); ++i)
+		health[i] = (int)(i % 100);
+	system.Scatter("Health", type, health.data(), health.size());
 
-	template <class C_>
-	class cFactory : public iFactory
+	const char* files[] = { "benchmark_variants.xml", "benchmark_complete.xml" };
+	const char* labels[] = { "variants", "complete objects" };
+	std::vector<cSharedString> names[2];
+	std::vector<Vector3> positions[2];
+	for (int format = 0; format < 2; ++format)
 	{
-	public:
-		cFactory(const char* type) : Type(type) {}
+		if (format == 1)
+			for (auto& h : handles)
+				system.SetPrototype(h, cObjectSystem::tHandle());
 
-		// iFactory:
-		virtual iBaseObject* Create(uint id, const char* name) const override { return new C_(id); }
-		virtual const char* GetType() const override { return Type.c_str(); }
-		// iFactory.
+		cStopwatch save;
+		system.SaveXML(files[format]);
+		const double saveTime = save.GetMilliseconds();
 
-	private:
-		const std::string Type;
-	};
+		cObjectSystem loaded;
+		loaded.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		cStopwatch load;
+		loaded.LoadXML(files[format]);
+		const double loadTime = load.GetMilliseconds();
 
-public:
-	cObjectSystem() : NextID(0) {}
+		std::string text;
+		ReadFile(files[format], text);
+		names[format].resize(count + 1);
+		positions[format].resize(count + 1);
+		loaded.Gather("Name", type, names[format].data(), count + 1);
+		loaded.Gather("Position", type, positions[format].data(), count + 1);
+		loaded.Gather("Health", type, health.data(), count + 1);
+		size_t shared = 0;
+		for (auto& name : names[format])
+			shared += name.IsShared(names[format][0]) ? 1 : 0;
+		printf("  %-18s save %10.1f ms, load %10.1f ms, %10u bytes, %u names sharing one buffer\n", labels[format], saveTime, loadTime, (uint)text.size(), (uint)shared);
+		for (size_t i = 0; i < health.size(); ++i)
+			if (health[i] != (int)(i % 100))
+				positions[format].clear();
+	}
+	const bool identical = names[0] == names[1] && positions[0].size() == positions[1].size() &&
+		memcmp(positions[0].data(), positions[1].data(), positions[0].size() * sizeof(Vector3)) == 0;
+	printf("  reloaded objects %s\n", identical ? "identical" : "DIFFER");
 
-	void SaveXML(const char* file);
-	void LoadXML(const char* file);
+	remove("benchmark_variants.xml");
+	remove("benchmark_complete.xml");
+}
 
-	template <class C_>
-	C_* Create(const char* name)
+// Strict cXMLNodeDeserializer skipping properties that throw.
+struct cCatchingXMLLoader
+{
+	cXMLNodeDeserializer& Loader;
+	size_t Failures;
+
+	template <class T_>
+	void operator()(const char* name, T_& v)
 	{
-		if (const iFactory* f = FindFactory(C_::SObjectType))
+		try
 		{
-			iBaseObject* object = f->Create(NextID++, name);
-			RegisterObject(*object);
-			return static_cast<C_*>(object);
+			Loader(name, v);
+		}
+		catch (boost::property_tree::ptree_error&)
+		{
+			++Failures;
 		}
-		return nullptr;
 	}
+};
+
+// Loading a file where every actor lacks its health and has a malformed position: reported
+// by a lenient load, or caught per property as a loader without one would have to.
+void BenchmarkLenientLoad(size_t count)
+{
+	printf("Lenient XML load, %u actors:\n", (uint)count);
 
-	template <class C_>
-	void Delete(C_*& object)
 	{
-		UnregisterObject(*object);
-		object = nullptr;
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		for (size_t i = 0; i < count; ++i)
+			system.Create<cActor>("Termogoyf");
+		system.SaveXML("benchmark_complete.xml");
 	}
-
-	void RegisterFactory(rFactory f)
+	std::string text, damaged;
+	ReadFile("benchmark_complete.xml", text);
+	damaged.reserve(text.size());
+	for (size_t begin = 0, end; begin < text.size(); begin = end)
 	{
-		Factories.push_back(std::move(f));
+		end = text.find("<Health>", begin);
+		damaged.append(text, begin, std::min(end, text.size()) - begin);
+		if (end == std::string::npos)
+			break;
+		end = text.find("</Health>", end) + strlen("</Health>");
+		const size_t y = text.find("<y>", end) + strlen("<y>");
+		damaged.append(text, end, y - end);
+		damaged.append("n/a");
+		end = text.find("</y>", y);
+	}
+	{
+		std::ofstream stream("benchmark_damaged.xml", std::ios::binary);
+		stream.write(damaged.data(), damaged.size());
 	}
 
-private:
-	void RegisterObject(iBaseObject& object) { Registery.push_back(&object); }
-	void UnregisterObject(iBaseObject& object) { Registery.erase(std::find(Registery.begin(), Registery.end(), &object)); }
-
-	const iFactory* FindFactory(const std::string& type) const
+	const char* files[] = { "benchmark_complete.xml", "benchmark_complete.xml", "benchmark_damaged.xml" };
+	const char* labels[] = { "complete, strict", "complete, lenient", "damaged, lenient" };
+	for (int run = 0; run < 3; ++run)
+	{
+		cLoadDiagnostics diagnostics;
+		cObjectSystem system;
+		system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+		if (run > 0)
+			system.SetLoadDiagnostics(&diagnostics);
+		cStopwatch sw;
+		system.LoadXML(files[run]);
+		printf("  %-24s %10.1f ms, %u diagnostics\n", labels[run], sw.GetMilliseconds(), (uint)diagnostics.Get().size());
+	}
 	{
-		auto& it = std::find_if(Factories.begin(), Factories.end(), [&type](const rFactory& f) { return type == f->GetType(); });
-		return (it != Factories.end()) ? it->get() : nullptr;
+		cStopwatch sw;
+		cXMLDocument document("benchmark_damaged.xml");
+		size_t failures = 0;
+		for (const tXMLNode* node = document.GetRoot().first_node(); node; node = node->next_sibling())
+		{
+			cActor actor(0);
+			cXMLNodeDeserializer loader(*node);
+			cCatchingXMLLoader catcher = { loader, 0 };
+			VisitProperties(actor, catcher);
+			failures += catcher.Failures;
+		}
+		printf("  %-24s %10.1f ms, %u exceptions\n", "damaged, caught", sw.GetMilliseconds(), (uint)failures);
 	}
 
-	typedef std::vector<iBaseObject*> tRegistry;
-	tRegistry Registery;
+	remove("benchmark_complete.xml");
+	remove("benchmark_damaged.xml");
+}
 
-	typedef std::vector<rFactory> tFactories;
-	tFactories Factories;
+// Reloading a watched file after editing a few of its actors, against loading it again.
+void BenchmarkHotReload(size_t count, size_t edits)
+{
+	printf("Hot reload, %u actors, %u edited:\n", (uint)count, (uint)edits);
 
-	uint NextID;
-};
+	cObjectSystem system;
+	system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+	system.CreateN<cActor>(count, "Actor");
+	system.SaveXML("benchmark_reload.xml");
 
-void cObjectSystem::SaveXML(const char* file)
-{
-	tBoostPTree pt;
-	for (auto& obj : Registery)
+	cObjectSystem loaded;
+	loaded.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
 	{
-		tBoostPTree element;
-		cXMLSerializer saver(element, *obj->GetProperties().CreateIterator());
-		pt.add_child(obj->GetObjectType(), element);
+		cStopwatch sw;
+		loaded.LoadXML("benchmark_reload.xml");
+		printf("  LoadXML                  %10.1f ms\n", sw.GetMilliseconds());
 	}
-	write_xml(file, pt);
+	{
+		cStopwatch sw;
+		loaded.WatchXML("benchmark_reload.xml");
+		printf("  WatchXML                 %10.1f ms\n", sw.GetMilliseconds());
+	}
+	{
+		cStopwatch sw;
+		const size_t set = loaded.ReloadXML("benchmark_reload.xml");
+		printf("  ReloadXML, unchanged     %10.1f ms, %u values set\n", sw.GetMilliseconds(), (uint)set);
+	}
+
+	// Spread over the file, each edit renames an actor.
+	std::string text;
+	ReadFile("benchmark_reload.xml", text);
+	size_t position = 0;
+	for (size_t i = 0; i < edits; ++i)
+	{
+		position = text.find("<Name>Actor</Name>", position + text.size() / edits / 2);
+		if (position == std::string::npos)
+			break;
+		text.replace(position, strlen("<Name>Actor</Name>"), "<Name>Edited</Name>");
+	}
+	{
+		std::ofstream stream("benchmark_reload.xml", std::ios::binary);
+		stream.write(text.data(), text.size());
+	}
+	{
+		cStopwatch sw;
+		const size_t set = loaded.ReloadXML("benchmark_reload.xml");
+		printf("  ReloadXML, edited        %10.1f ms, %u values set\n", sw.GetMilliseconds(), (uint)set);
+	}
+
+	remove("benchmark_reload.xml");
 }
 
-void cObjectSystem::LoadXML(const char* file)
+// Cloning a template actor, against a ptree round trip through the serializers.
+void BenchmarkClone(size_t count)
 {
-	tBoostPTree pt;
-	read_xml(file, pt);
-	for (auto& element : pt.get_child(""))
+	printf("Cloning, %u copies of one actor:\n", (uint)count);
+
+	cObjectSystem system;
+	system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+	cObjectSystem::tHandle original = system.Create<cActor>("Termogoyf");
+	for (cProperty p : system.Get<cActor>(original)->GetProperties())
+		if (strcmp(p.GetName(), "Name") == 0)
+			p.SetValue<const char*>("Lesser Termogoyf of the Eastern Marshes");
+
+	const size_t roundTrips = count / 100;
 	{
-		if (const iFactory* f = FindFactory(element.first))
+		cStopwatch sw;
+		for (size_t i = 0; i < roundTrips; ++i)
 		{
-			iBaseObject* object = f->Create(0, "");
-			cXMLDeserializer loader(element.second, *object->GetProperties().CreateIterator());
-			RegisterObject(*object);
+			tBoostPTree pt;
+			cXMLSerializer saver(pt, system.Get<cActor>(original)->GetProperties());
+			cActor* copy = system.Get<cActor>(system.Create<cActor>(""));
+			cXMLDeserializer loader(pt, copy->GetProperties());
 		}
+		const double ms = sw.GetMilliseconds();
+		printf("  ptree round trip         %10.1f ms, %8.3f us per object (%u objects)\n", ms, ms * 1000.0 / roundTrips, (uint)roundTrips);
+	}
+	{
+		cStopwatch sw;
+		for (size_t i = 0; i < roundTrips; ++i)
+			system.Clone(original);
+		const double ms = sw.GetMilliseconds();
+		printf("  Clone                    %10.1f ms, %8.3f us per object (%u objects)\n", ms, ms * 1000.0 / roundTrips, (uint)roundTrips);
 	}
+	std::vector<cObjectSystem::tHandle> handles;
+	{
+		cStopwatch sw;
+		system.CloneN(original, count, &handles);
+		const double ms = sw.GetMilliseconds();
+		printf("  CloneN                   %10.1f ms, %8.3f us per object\n", ms, ms * 1000.0 / count);
+	}
+
+	// All but the IDs.
+	const size_t total = system.Gather<int>("Health", cTypeNames::Of<cActor>(), nullptr, 0);
+	std::vector<cSharedString> names(total);
+	std::vector<Vector3> positions(total);
+	system.Gather("Name", cTypeNames::Of<cActor>(), names.data(), total);
+	system.Gather("Position", cTypeNames::Of<cActor>(), positions.data(), total);
+	bool identical = true;
+	for (size_t i = 0; i < total; ++i)
+		identical = identical && names[i] == names[0] && memcmp(&positions[i], &positions[0], sizeof(Vector3)) == 0;
+	printf("  clones %s\n", identical ? "identical" : "DIFFER");
 }
 
-class cActor : public cBaseObject
+// Counts what it is told.
+class cCountingObserver : public iPropertyObserver
 {
 public:
-	static const std::string SObjectType;
+	cCountingObserver() : Batches(0), Changes(0) {}
 
-	cActor(uint id)
-		: cBaseObject(id, SObjectType.c_str())
-		, Name("Actor")
-		, Health(100)
-		, Pos(100.f, 50.f, 0.f)
+	// iPropertyObserver:
+	virtual void OnPropertiesChanged(const cPropertyChange* changes, size_t count) override
 	{
-		PList.Register(cPropertiesList::rProperty(new cProperty("Name", Name)));
-		PList.Register(cPropertiesList::rProperty(new cProperty("Health", Health)));
-		PList.Register(cPropertiesList::rProperty(new cProperty("Position", Pos)));
+		++Batches;
+		Changes += count;
 	}
-	~cActor() {}
+	// iPropertyObserver.
 
-private:
-	int Health;
-	std::string Name;
-	Vector3 Pos;
+	size_t Batches;
+	size_t Changes;
 };
 
-const std::string cActor::SObjectType = "Actor";
+// cProperty::SetValue() throughput with and without an observer, several writes per property
+// and frame.
+void BenchmarkObservers(size_t count, size_t frames, size_t writes)
+{
+	printf("Observers, %u actors, %u frames of %u writes to their health:\n", (uint)count, (uint)frames, (uint)writes);
+
+	cObjectSystem system;
+	system.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
+	std::vector<cObjectSystem::tHandle> handles;
+	system.CreateN<cActor>(count, "Actor", &handles);
+
+	cCountingObserver observer;
+	for (int observed = 0; observed < 2; ++observed)
+	{
+		if (observed)
+			system.AddObserver(observer);
+
+		// Bound after AddObserver(), as it requires.
+		std::vector<cProperty> health;
+		health.reserve(count);
+		for (auto& h : handles)
+			for (cProperty p : system.Get<cActor>(h)->GetProperties())
+				if (strcmp(p.GetName(), "Health") == 0)
+					health.push_back(p);
+
+		double setTime = 0.0;
+		double flushTime = 0.0;
+		for (size_t frame = 0; frame < frames; ++frame)
+		{
+			cStopwatch set;
+			for (size_t w = 0; w < writes; ++w)
+				for (auto& p : health)
+					p.SetValue((int)(frame + w));
+			setTime += set.GetMilliseconds();
+
+			cStopwatch flush;
+			system.FlushChanges();
+			flushTime += flush.GetMilliseconds();
+		}
+		const double ns = setTime * 1e6 / (double(count) * frames * writes);
+		printf("  %-24s set %10.1f ms, %6.2f ns per write, flush %8.1f ms\n", observed ? "observed" : "no observer", setTime, ns, flushTime);
+	}
+	printf("  %u batches, %u changes reported\n", (uint)observer.Batches, (uint)observer.Changes);
+	system.RemoveObserver(observer);
+}
+
+void RunBenchmarks()
+{
+	BenchmarkPropertyVisitors(1000000);
+	BenchmarkSaveXML(200000);
+	BenchmarkSnapshots(1000000);
+	BenchmarkParallelXML(1000000);
+	BenchmarkGather(1000000);
+	BenchmarkColumns(1000000);
+	BenchmarkVector3Kernels(1000000);
+	BenchmarkFloatText(1000000);
+	BenchmarkIntegerText(10000000);
+	BenchmarkCachedStreams(1000000);
+	BenchmarkArrays(1000, 1000);
+	BenchmarkPrototypes(1000000);
+	BenchmarkLenientLoad(1000000);
+	BenchmarkHotReload(1000000, 10);
+	BenchmarkClone(1000000);
+	BenchmarkObservers(1000000, 10, 4);
+}
 
 int _tmain(int argc, _TCHAR* argv[])
 {
+	if (argc > 1 && _tcscmp(argv[1], _T("-benchmark")) == 0)
+	{
+		RunBenchmarks();
+		return 0;
+	}
+	if (argc > 1 && _tcscmp(argv[1], _T("-selftest")) == 0)
+		return RunSelfChecks() ? 0 : 1;
+
 	cObjectSystem ObjectSystem;
 	ObjectSystem.RegisterFactory(cObjectSystem::rFactory(new cObjectSystem::cFactory<cActor>(cActor::SObjectType.c_str())));
 
-	cActor* actor = ObjectSystem.Create<cActor>("Termogoyf");
+	cObjectSystem::tHandle actor = ObjectSystem.Create<cActor>("Termogoyf");
 
 	ObjectSystem.SaveXML("termogoyf.xml");
 
 	ObjectSystem.LoadXML("termogoyf.xml");
 
-	ObjectSystem.Delete<cActor>(actor);
+	ObjectSystem.Delete(actor);
+	assert(ObjectSystem.Get<cActor>(actor) == nullptr);
 
 	return 0;
 }
\ No newline at end of file